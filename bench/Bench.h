@@ -0,0 +1,297 @@
+#ifndef COFSM_BENCH_H
+#define COFSM_BENCH_H
+
+// A small benchmark runner for CoFSM.
+// A benchmark is a function which takes Bench::Context&, does its setup and
+// calls ctx.measure(numberOfOperations, body) to time the body.
+// Each benchmark is run once for warm-up and then repeated the given number of times.
+// The results, including every repetition and their statistics, are written in JSON.
+//
+// Command line options of every benchmark program:
+//   --repetitions=N   Number of measured repetitions (default 5)
+//   --filter=TEXT     Run only the benchmarks whose name contains TEXT
+//   --out=FILE        Write JSON to FILE instead of stdout
+//   --quick           Use smaller problem sizes (for smoke testing)
+//   --perf            Count hardware events (cycles, instructions, cache misses...)
+//                     around each measurement and report them per operation.
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <algorithm>
+#include <memory>
+
+#include "PerfCounters.h"
+
+namespace Bench {
+
+// Keeps the compiler from optimizing away a value which is computed only for benchmarking.
+template <class T>
+inline void doNotOptimize(const T& value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Parameters of a benchmark as {name, value} pairs in the order they were given.
+using Params = std::vector<std::pair<std::string, std::string>>;
+
+// Helper for making a parameter from any streamable value.
+template <class T>
+std::pair<std::string, std::string> param(std::string name, const T& value)
+{
+    std::ostringstream ss;
+    ss << value;
+    return {std::move(name), ss.str()};
+}
+
+// Result of one repetition.
+struct Sample
+{
+    double seconds = 0;
+    std::uint64_t operations = 0;
+    std::map<std::string, double> counters; // Extra numbers reported by the benchmark
+};
+
+// Passed to each benchmark function.
+class Context
+{
+public:
+    // Times body() which is supposed to do the given number of operations.
+    // May be called several times per repetition, in which case the times and operations add up.
+    template <class F>
+    void measure(std::uint64_t operations, F&& body)
+    {
+        if (_pPerf)
+            _pPerf->start();
+        const auto start = std::chrono::steady_clock::now();
+        body();
+        const auto end = std::chrono::steady_clock::now();
+        if (_pPerf)
+            _pPerf->stop();
+        _sample.seconds += std::chrono::duration<double>(end - start).count();
+        _sample.operations += operations;
+    }
+
+    // Reports an extra number, such as bytes per state, for this repetition.
+    void counter(const std::string& name, double value) { _sample.counters[name] = value; }
+
+    // Time measured so far in this repetition, in seconds.
+    double elapsed() const { return _sample.seconds; }
+
+    // True if the problem sizes should be kept small.
+    bool quick() const { return _bQuick; }
+
+private:
+    friend class Suite;
+    Sample _sample;
+    bool _bQuick = false;
+    PerfCounters* _pPerf = nullptr;
+};
+
+// Mean, standard deviation and extremes of a series of numbers.
+struct Stats
+{
+    double mean = 0, stddev = 0, min = 0, max = 0, median = 0;
+
+    static Stats of(std::vector<double> v)
+    {
+        Stats s;
+        if (v.empty())
+            return s;
+        std::sort(v.begin(), v.end());
+        s.min = v.front();
+        s.max = v.back();
+        s.median = (v.size() % 2) ? v[v.size() / 2] : (v[v.size() / 2 - 1] + v[v.size() / 2]) / 2;
+        s.mean = std::accumulate(v.begin(), v.end(), 0.0) / double(v.size());
+        double sq = 0;
+        for (double x : v)
+            sq += (x - s.mean) * (x - s.mean);
+        s.stddev = v.size() > 1 ? std::sqrt(sq / double(v.size() - 1)) : 0.0;
+        return s;
+    }
+};
+
+// A collection of benchmarks which are run and reported together.
+class Suite
+{
+public:
+    using Function = std::function<void(Context&)>;
+
+    Suite(std::string suiteName, int argc, char** argv) : _name(std::move(suiteName))
+    {
+        for (int i = 1; i < argc; ++i) {
+            std::string_view arg = argv[i];
+            if (arg.starts_with("--repetitions="))
+                _repetitions = std::max(1, std::stoi(std::string(arg.substr(14))));
+            else if (arg.starts_with("--filter="))
+                _filter = arg.substr(9);
+            else if (arg.starts_with("--out="))
+                _outFile = arg.substr(6);
+            else if (arg == "--quick")
+                _bQuick = true;
+            else if (arg == "--perf")
+                _pPerf = std::make_unique<PerfCounters>();
+            else
+                throw std::runtime_error("Unknown option '" + std::string(arg) + "'");
+        }
+    }
+
+    bool quick() const { return _bQuick; }
+
+    // Adds a benchmark. The name and the parameters identify it in the results.
+    void add(std::string name, Params params, Function f)
+    {
+        _benchmarks.push_back({std::move(name), std::move(params), std::move(f)});
+    }
+
+    // Runs the benchmarks and writes the results. Returns the exit code of the program.
+    int run()
+    {
+        std::ostringstream json;
+        json << "{\n  \"suite\": " << quoted(_name) << ",\n  \"repetitions\": " << _repetitions
+             << ",\n  \"perf_counters\": " << quoted(perfStatus()) << ",\n  \"benchmarks\": [";
+        bool bFirst = true;
+        for (const auto& b : _benchmarks) {
+            if (!_filter.empty() && b.name.find(_filter) == std::string::npos)
+                continue;
+            std::vector<Sample> samples;
+            for (int rep = -1; rep < _repetitions; ++rep) { // Repetition -1 is the warm-up.
+                Context ctx;
+                ctx._bQuick = _bQuick;
+                if (_pPerf && _pPerf->available()) {
+                    _pPerf->reset();
+                    ctx._pPerf = _pPerf.get();
+                }
+                b.function(ctx);
+                if (ctx._pPerf) { // Report the hardware events per operation.
+                    const double ops = double(std::max<std::uint64_t>(ctx._sample.operations, 1));
+                    for (const auto& [name, value] : ctx._pPerf->readings())
+                        ctx._sample.counters["perf." + name + "_per_op"] = value / ops;
+                }
+                if (rep >= 0)
+                    samples.push_back(std::move(ctx._sample));
+            }
+            json << (bFirst ? "\n" : ",\n");
+            bFirst = false;
+            writeBenchmark(json, b, samples);
+            printSummary(b, samples);
+        }
+        json << "\n  ]\n}\n";
+
+        if (_outFile.empty()) {
+            std::cout << json.str();
+        } else {
+            std::ofstream out(_outFile);
+            out << json.str();
+            if (!out)
+                throw std::runtime_error("Can not write to '" + _outFile + "'");
+        }
+        return 0;
+    }
+
+private:
+    struct Benchmark
+    {
+        std::string name;
+        Params params;
+        Function function;
+    };
+
+    static std::string quoted(std::string_view s)
+    {
+        std::string r = "\"";
+        for (char c : s) {
+            if (c == '"' || c == '\\')
+                r += '\\';
+            r += c;
+        }
+        return r + '"';
+    }
+
+    std::string perfStatus() const
+    {
+        if (!_pPerf)
+            return "off";
+        if (!_pPerf->available())
+            return "unavailable: " + _pPerf->error();
+        return _pPerf->error().empty() ? "on" : "partial: " + _pPerf->error();
+    }
+
+    static void writeStats(std::ostream& os, const Stats& s)
+    {
+        os << "{\"mean\": " << s.mean << ", \"stddev\": " << s.stddev << ", \"min\": " << s.min
+           << ", \"max\": " << s.max << ", \"median\": " << s.median << "}";
+    }
+
+    static std::string fullName(const Benchmark& b)
+    {
+        std::string name = b.name;
+        for (const auto& [key, value] : b.params)
+            name += "/" + key + ":" + value;
+        return name;
+    }
+
+    void writeBenchmark(std::ostream& os, const Benchmark& b, const std::vector<Sample>& samples) const
+    {
+        std::vector<double> nsPerOp, opsPerSec;
+        std::map<std::string, std::vector<double>> counters;
+        for (const auto& s : samples) {
+            const double ops = double(std::max<std::uint64_t>(s.operations, 1));
+            nsPerOp.push_back(s.seconds * 1e9 / ops);
+            opsPerSec.push_back(s.seconds > 0 ? ops / s.seconds : 0.0);
+            for (const auto& [name, value] : s.counters)
+                counters[name].push_back(value);
+        }
+        os.precision(6);
+        os << "    {\n      \"name\": " << quoted(b.name) << ",\n      \"full_name\": " << quoted(fullName(b))
+           << ",\n      \"params\": {";
+        for (std::size_t i = 0; i < b.params.size(); ++i)
+            os << (i ? ", " : "") << quoted(b.params[i].first) << ": " << quoted(b.params[i].second);
+        os << "},\n      \"operations\": " << (samples.empty() ? 0 : samples.front().operations)
+           << ",\n      \"ns_per_op\": ";
+        writeStats(os, Stats::of(nsPerOp));
+        os << ",\n      \"ops_per_sec\": ";
+        writeStats(os, Stats::of(opsPerSec));
+        os << ",\n      \"counters\": {";
+        for (bool bFirstCounter = true; const auto& [name, values] : counters) {
+            os << (bFirstCounter ? "\n        " : ",\n        ") << quoted(name) << ": ";
+            writeStats(os, Stats::of(values));
+            bFirstCounter = false;
+        }
+        os << (counters.empty() ? "" : "\n      ") << "},\n      \"samples_ns_per_op\": [";
+        for (std::size_t i = 0; i < nsPerOp.size(); ++i)
+            os << (i ? ", " : "") << nsPerOp[i];
+        os << "]\n    }";
+    }
+
+    static void printSummary(const Benchmark& b, const std::vector<Sample>& samples)
+    {
+        std::vector<double> nsPerOp;
+        for (const auto& s : samples)
+            nsPerOp.push_back(s.seconds * 1e9 / double(std::max<std::uint64_t>(s.operations, 1)));
+        Stats st = Stats::of(nsPerOp);
+        std::cerr << fullName(b) << ": " << st.median << " ns/op (+- " << st.stddev << ")\n";
+    }
+
+    std::string _name;
+    int _repetitions = 5;
+    std::string _filter;
+    std::string _outFile;
+    bool _bQuick = false;
+    std::unique_ptr<PerfCounters> _pPerf;
+    std::vector<Benchmark> _benchmarks;
+};
+
+} // namespace Bench
+#endif // COFSM_BENCH_H
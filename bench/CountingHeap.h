@@ -0,0 +1,81 @@
+#ifndef COFSM_COUNTING_HEAP_H
+#define COFSM_COUNTING_HEAP_H
+
+// Replaces the global operator new and delete with versions which count the live bytes,
+// the live blocks and the allocations. Include in one translation unit of a program only.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+// Counting heap. Each block has a header which stores the size of the block.
+namespace Heap {
+
+constexpr std::size_t smallSizes = 1024; // Blocks smaller than this are counted per size.
+
+std::atomic<std::size_t> liveBytes = 0, liveBlocks = 0, allocations = 0;
+std::array<std::atomic<std::size_t>, smallSizes> liveBlocksBySize{};
+
+std::size_t headerSize(std::size_t alignment)
+{
+    return std::max<std::size_t>(alignment, 2 * sizeof(std::size_t));
+}
+
+void* allocate(std::size_t size, std::size_t alignment)
+{
+    const std::size_t header = headerSize(alignment);
+    const std::size_t total = (header + size + alignment - 1) / alignment * alignment;
+    char* base = static_cast<char*>(std::aligned_alloc(alignment, total));
+    if (!base)
+        throw std::bad_alloc();
+    char* p = base + header;
+    reinterpret_cast<std::size_t*>(p)[-1] = size;
+    liveBytes.fetch_add(size, std::memory_order_relaxed);
+    liveBlocks.fetch_add(1, std::memory_order_relaxed);
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (size < smallSizes)
+        liveBlocksBySize[size].fetch_add(1, std::memory_order_relaxed);
+    return p;
+}
+
+void deallocate(void* ptr, std::size_t alignment) noexcept
+{
+    if (!ptr)
+        return;
+    char* p = static_cast<char*>(ptr);
+    const std::size_t size = reinterpret_cast<std::size_t*>(p)[-1];
+    liveBytes.fetch_sub(size, std::memory_order_relaxed);
+    liveBlocks.fetch_sub(1, std::memory_order_relaxed);
+    if (size < smallSizes)
+        liveBlocksBySize[size].fetch_sub(1, std::memory_order_relaxed);
+    std::free(p - headerSize(alignment));
+}
+
+// Snapshot of the counters.
+struct Snapshot
+{
+    std::size_t bytes, blocks, allocations;
+    std::array<std::size_t, smallSizes> blocksBySize;
+
+    static Snapshot take()
+    {
+        Snapshot s{liveBytes.load(), liveBlocks.load(), Heap::allocations.load(), {}};
+        for (std::size_t i = 0; i < smallSizes; ++i)
+            s.blocksBySize[i] = liveBlocksBySize[i].load(std::memory_order_relaxed);
+        return s;
+    }
+};
+
+} // namespace Heap
+
+void* operator new(std::size_t size) { return Heap::allocate(size, alignof(std::max_align_t)); }
+void* operator new(std::size_t size, std::align_val_t al) { return Heap::allocate(size, std::size_t(al)); }
+void operator delete(void* p) noexcept { Heap::deallocate(p, alignof(std::max_align_t)); }
+void operator delete(void* p, std::size_t) noexcept { Heap::deallocate(p, alignof(std::max_align_t)); }
+void operator delete(void* p, std::align_val_t al) noexcept { Heap::deallocate(p, std::size_t(al)); }
+void operator delete(void* p, std::size_t, std::align_val_t al) noexcept { Heap::deallocate(p, std::size_t(al)); }
+
+#endif // COFSM_COUNTING_HEAP_H
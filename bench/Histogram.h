@@ -0,0 +1,118 @@
+#ifndef COFSM_HISTOGRAM_H
+#define COFSM_HISTOGRAM_H
+
+// Latency histogram in the style of HdrHistogram.
+// The values are counted in log-linear buckets so that every recorded value is kept
+// with the given number of significant decimal digits over the whole range.
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+namespace Bench {
+
+class Histogram
+{
+public:
+    // Values up to 'highestValue' are kept with 'significantDigits' (1...5) decimal digits.
+    // Greater values are counted as 'highestValue'.
+    explicit Histogram(std::uint64_t highestValue = std::uint64_t(1) << 42, int significantDigits = 3)
+        : _highestValue(std::max<std::uint64_t>(highestValue, 2))
+    {
+        if (significantDigits < 1 || significantDigits > 5)
+            throw std::runtime_error("Histogram: significant digits must be 1...5");
+        const auto resolution = std::uint64_t(2 * std::pow(10.0, significantDigits));
+        _subBucketBits = std::bit_width(resolution - 1);
+        _counts.resize(index(_highestValue) + 1);
+    }
+
+    void record(std::uint64_t value, std::uint64_t count = 1)
+    {
+        value = std::min(value, _highestValue);
+        _counts[index(value)] += count;
+        _total += count;
+        _min = std::min(_min, value);
+        _max = std::max(_max, value);
+        _sum += double(value) * double(count);
+    }
+
+    void merge(const Histogram& other)
+    {
+        if (other._counts.size() != _counts.size() || other._subBucketBits != _subBucketBits)
+            throw std::runtime_error("Histogram: can not merge histograms of different ranges");
+        for (std::size_t i = 0; i < _counts.size(); ++i)
+            _counts[i] += other._counts[i];
+        _total += other._total;
+        _min = std::min(_min, other._min);
+        _max = std::max(_max, other._max);
+        _sum += other._sum;
+    }
+
+    void reset()
+    {
+        std::fill(_counts.begin(), _counts.end(), 0);
+        _total = 0;
+        _min = std::numeric_limits<std::uint64_t>::max();
+        _max = 0;
+        _sum = 0;
+    }
+
+    std::uint64_t count() const { return _total; }
+    std::uint64_t min() const { return _total ? _min : 0; }
+    std::uint64_t max() const { return _max; }
+    double mean() const { return _total ? _sum / double(_total) : 0.0; }
+
+    // Returns the value below or at which the given percentage (0...100) of the values are.
+    // The value is the highest one which is equivalent to it within the resolution.
+    std::uint64_t percentile(double percent) const
+    {
+        if (_total == 0)
+            return 0;
+        const auto rank = std::max<std::uint64_t>(1, std::uint64_t(std::ceil(std::clamp(percent, 0.0, 100.0) / 100.0 * double(_total))));
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < _counts.size(); ++i)
+            if ((seen += _counts[i]) >= rank)
+                return std::min(highestEquivalent(i), _max);
+        return _max;
+    }
+
+private:
+    // Values below 2^bits are counted exactly. Above that, each power of 2 is split
+    // into 2^(bits-1) linear buckets.
+    std::size_t index(std::uint64_t value) const
+    {
+        const std::uint64_t subBuckets = std::uint64_t(1) << _subBucketBits;
+        if (value < subBuckets)
+            return std::size_t(value);
+        const int shift = std::bit_width(value) - _subBucketBits;
+        const std::uint64_t half = subBuckets / 2;
+        return std::size_t(subBuckets + std::uint64_t(shift - 1) * half + ((value >> shift) - half));
+    }
+
+    std::uint64_t highestEquivalent(std::size_t i) const
+    {
+        const std::uint64_t subBuckets = std::uint64_t(1) << _subBucketBits;
+        if (i < subBuckets)
+            return i;
+        const std::uint64_t half = subBuckets / 2;
+        const std::uint64_t j = i - subBuckets;
+        const int shift = int(j / half) + 1;
+        const std::uint64_t top = j % half + half;
+        return ((top + 1) << shift) - 1;
+    }
+
+    std::uint64_t _highestValue;
+    int _subBucketBits;
+    std::vector<std::uint64_t> _counts;
+    std::uint64_t _total = 0;
+    std::uint64_t _min = std::numeric_limits<std::uint64_t>::max();
+    std::uint64_t _max = 0;
+    double _sum = 0;
+};
+
+} // namespace Bench
+#endif // COFSM_HISTOGRAM_H
@@ -0,0 +1,149 @@
+#ifndef COFSM_PERF_COUNTERS_H
+#define COFSM_PERF_COUNTERS_H
+
+// Hardware performance counters for the benchmarks using Linux perf_event_open.
+// Each counter is opened on its own so that the ones which the CPU or the container
+// does not allow are simply left out. If none can be opened, available() is false
+// and the benchmarks run without counters.
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__) && __has_include(<linux/perf_event.h>)
+#   include <linux/perf_event.h>
+#   include <sys/ioctl.h>
+#   include <sys/syscall.h>
+#   include <unistd.h>
+#   include <cerrno>
+#   include <cstring>
+#   define COFSM_HAS_PERF_EVENTS 1
+#else
+#   define COFSM_HAS_PERF_EVENTS 0
+#endif
+
+namespace Bench {
+
+class PerfCounters
+{
+public:
+    // Name and accumulated value of a counter.
+    using Reading = std::pair<std::string, double>;
+
+    PerfCounters()
+    {
+#if COFSM_HAS_PERF_EVENTS
+        auto cache = [](std::uint64_t cache, std::uint64_t op, std::uint64_t result) {
+            return cache | (op << 8) | (result << 16);
+        };
+        open("cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+        open("instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+        open("branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+        open("l1d_misses", PERF_TYPE_HW_CACHE,
+             cache(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS));
+        open("llc_misses", PERF_TYPE_HW_CACHE,
+             cache(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS));
+        open("dtlb_misses", PERF_TYPE_HW_CACHE,
+             cache(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS));
+#else
+        _error = "perf_event_open is not supported on this platform";
+#endif
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    ~PerfCounters()
+    {
+#if COFSM_HAS_PERF_EVENTS
+        for (auto& c : _counters)
+            close(c.fd);
+#endif
+    }
+
+    // True if at least one counter could be opened.
+    bool available() const { return !_counters.empty(); }
+
+    // Tells why some or all counters are missing.
+    const std::string& error() const { return _error; }
+
+    // Zeroes the accumulated values.
+    void reset()
+    {
+        for (auto& c : _counters)
+            c.value = 0;
+    }
+
+    // Starts counting.
+    void start()
+    {
+#if COFSM_HAS_PERF_EVENTS
+        for (auto& c : _counters) {
+            ioctl(c.fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(c.fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    // Stops counting and adds the counts since start() to the accumulated values.
+    // If the kernel had to multiplex the counters, the counts are scaled up.
+    void stop()
+    {
+#if COFSM_HAS_PERF_EVENTS
+        for (auto& c : _counters)
+            ioctl(c.fd, PERF_EVENT_IOC_DISABLE, 0);
+        for (auto& c : _counters) {
+            std::uint64_t data[3] = {}; // value, time enabled, time running
+            if (read(c.fd, data, sizeof(data)) == ssize_t(sizeof(data)) && data[2] > 0)
+                c.value += double(data[0]) * double(data[1]) / double(data[2]);
+        }
+#endif
+    }
+
+    // Returns the accumulated values.
+    std::vector<Reading> readings() const
+    {
+        std::vector<Reading> result;
+        for (const auto& c : _counters)
+            result.emplace_back(c.name, c.value);
+        return result;
+    }
+
+private:
+    struct Counter
+    {
+        std::string name;
+        int fd;
+        double value = 0;
+    };
+
+#if COFSM_HAS_PERF_EVENTS
+    void open(const char* name, std::uint32_t type, std::uint64_t config)
+    {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.inherit = 1; // Count also the threads started by the benchmark.
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        // This thread and its children on any CPU.
+        int fd = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        if (fd < 0) {
+            _error += std::string(_error.empty() ? "" : "; ") + name + ": " + std::strerror(errno);
+            return;
+        }
+        _counters.push_back(Counter{name, fd});
+    }
+#endif
+
+    std::vector<Counter> _counters;
+    std::string _error;
+};
+
+} // namespace Bench
+#endif // COFSM_PERF_COUNTERS_H
@@ -0,0 +1,241 @@
+#ifndef COFSM_TOPOLOGY_H
+#define COFSM_TOPOLOGY_H
+
+// Synthetic FSM topologies and event workloads for benchmarking.
+// generate() makes a graph of the given shape with random event names.
+// workload() makes a sequence of choices which tells which outgoing transition
+// each visited state takes. build() turns the graph into the states and the
+// transition table of an FSM whose states walk the graph according to the choices.
+// Everything is generated from a seed, so the same spec gives the same FSM.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <CoFSM.h>
+
+namespace Topology {
+
+enum class Shape
+{
+    Random,   // Each state has 'outDegree' transitions to random states
+    Star,     // A hub with a transition to every other state and back
+    Chain,    // Each state has a transition to the next one and the last one to the first one
+    Full,     // Each state has a transition to every other state
+    Clusters  // Random graphs of 'clusterSize' states. Each cluster has a transition to the next one.
+};
+
+enum class Workload
+{
+    Uniform,  // Every outgoing transition is equally likely
+    Zipf,     // The first transitions of every state are much more likely than the rest
+    Bursty    // The same choice is repeated for a random number of steps
+};
+
+struct Spec
+{
+    Shape shape = Shape::Random;
+    std::size_t numStates = 1024;
+    std::size_t outDegree = 4;      // For Random and Clusters
+    std::size_t clusterSize = 32;   // For Clusters
+    std::size_t eventNames = 64;    // Number of distinct event names. Raised to the largest out-degree if needed.
+    std::size_t minNameLength = 8;  // The lengths of the event names are uniformly distributed
+    std::size_t maxNameLength = 24; // between these two.
+    std::uint64_t seed = 1;
+};
+
+// Transition {event name, target state} out of a state.
+struct Edge
+{
+    std::uint32_t eventName;
+    std::uint32_t target;
+};
+
+struct Graph
+{
+    std::vector<std::string> eventNames;
+    std::vector<std::vector<Edge>> edges; // Outgoing transitions of every state. Never empty.
+    std::size_t maxOutDegree = 0;
+    std::size_t numTransitions = 0;
+};
+
+inline const char* toString(Shape shape)
+{
+    switch (shape) {
+    case Shape::Random: return "random";
+    case Shape::Star: return "star";
+    case Shape::Chain: return "chain";
+    case Shape::Full: return "full";
+    case Shape::Clusters: return "clusters";
+    }
+    return "?";
+}
+
+inline const char* toString(Workload workload)
+{
+    switch (workload) {
+    case Workload::Uniform: return "uniform";
+    case Workload::Zipf: return "zipf";
+    case Workload::Bursty: return "bursty";
+    }
+    return "?";
+}
+
+inline Graph generate(const Spec& spec)
+{
+    const std::size_t n = spec.numStates;
+    if (n < 2)
+        throw std::runtime_error("Topology::generate(): at least 2 states are needed");
+    std::mt19937_64 rng(spec.seed);
+    auto uniform = [&rng](std::size_t lo, std::size_t hi) { return std::uniform_int_distribution<std::size_t>(lo, hi)(rng); };
+
+    // Targets of the transitions.
+    std::vector<std::vector<std::uint32_t>> targets(n);
+    auto randomTargets = [&](std::size_t from, std::size_t first, std::size_t count, std::size_t degree) {
+        degree = std::min(degree, count - 1);
+        while (targets[from].size() < degree) {
+            auto to = std::uint32_t(first + uniform(0, count - 1));
+            if (to != from && std::find(targets[from].begin(), targets[from].end(), to) == targets[from].end())
+                targets[from].push_back(to);
+        }
+    };
+    switch (spec.shape) {
+    case Shape::Random:
+        for (std::size_t i = 0; i < n; ++i)
+            randomTargets(i, 0, n, std::max<std::size_t>(spec.outDegree, 1));
+        break;
+    case Shape::Star:
+        for (std::size_t i = 1; i < n; ++i) {
+            targets[0].push_back(std::uint32_t(i));
+            targets[i].push_back(0);
+        }
+        break;
+    case Shape::Chain:
+        for (std::size_t i = 0; i < n; ++i)
+            targets[i].push_back(std::uint32_t((i + 1) % n));
+        break;
+    case Shape::Full:
+        for (std::size_t i = 0; i < n; ++i)
+            for (std::size_t j = 0; j < n; ++j)
+                if (i != j)
+                    targets[i].push_back(std::uint32_t(j));
+        break;
+    case Shape::Clusters: {
+        const std::size_t size = std::clamp<std::size_t>(spec.clusterSize, 2, n);
+        for (std::size_t first = 0; first < n; first += size) {
+            const std::size_t count = std::min(size, n - first);
+            for (std::size_t i = first; i < first + count; ++i)
+                if (count > 1)
+                    randomTargets(i, first, count, std::max<std::size_t>(spec.outDegree, 2) - 1);
+            // The first state of a cluster is its gateway to the next cluster.
+            targets[first].push_back(std::uint32_t((first + count) % n));
+        }
+        break;
+    }
+    }
+
+    Graph g;
+    for (const auto& t : targets) {
+        g.maxOutDegree = std::max(g.maxOutDegree, t.size());
+        g.numTransitions += t.size();
+    }
+
+    // Event names of random lengths. The outgoing transitions of a state must have distinct names.
+    const std::size_t numNames = std::max(spec.eventNames, g.maxOutDegree);
+    const std::size_t minLength = std::max<std::size_t>(spec.minNameLength, 1);
+    for (std::size_t k = 0; k < numNames; ++k) {
+        std::string name = std::to_string(k) + "_";
+        const std::size_t length = std::max(name.size(), uniform(minLength, std::max(minLength, spec.maxNameLength)));
+        while (name.size() < length)
+            name += char('a' + uniform(0, 25));
+        g.eventNames.push_back(std::move(name));
+    }
+
+    g.edges.resize(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        const std::size_t firstName = uniform(0, numNames - 1);
+        for (std::size_t k = 0; k < targets[i].size(); ++k)
+            g.edges[i].push_back(Edge{std::uint32_t((firstName + k) % numNames), targets[i][k]});
+    }
+    return g;
+}
+
+// Makes 'length' choices in the range [0, range).
+inline std::vector<std::uint32_t> workload(Workload kind, std::size_t length, std::size_t range, std::uint64_t seed = 1,
+                                           double zipfExponent = 1.0, std::size_t maxBurst = 64)
+{
+    std::mt19937_64 rng(seed);
+    std::uniform_int_distribution<std::uint32_t> uniform(0, std::uint32_t(std::max<std::size_t>(range, 1) - 1));
+    std::vector<std::uint32_t> choices;
+    choices.reserve(length);
+    switch (kind) {
+    case Workload::Uniform:
+        while (choices.size() < length)
+            choices.push_back(uniform(rng));
+        break;
+    case Workload::Zipf: {
+        std::vector<double> cdf(std::max<std::size_t>(range, 1));
+        double sum = 0;
+        for (std::size_t k = 0; k < cdf.size(); ++k)
+            cdf[k] = (sum += 1.0 / std::pow(double(k + 1), zipfExponent));
+        std::uniform_real_distribution<double> u(0, sum);
+        while (choices.size() < length)
+            choices.push_back(std::uint32_t(std::lower_bound(cdf.begin(), cdf.end(), u(rng)) - cdf.begin()));
+        break;
+    }
+    case Workload::Bursty: {
+        std::uniform_int_distribution<std::size_t> burst(1, std::max<std::size_t>(maxBurst, 1));
+        while (choices.size() < length)
+            choices.insert(choices.end(), std::min(burst(rng), length - choices.size()), uniform(rng));
+        break;
+    }
+    }
+    return choices;
+}
+
+// Payload of the events which walk the graph.
+struct Walk
+{
+    const std::vector<std::uint32_t>* choices;
+    std::size_t position;
+    std::uint64_t stepsLeft;
+};
+
+// A state which takes the outgoing transition given by the next choice of the walk.
+// Suspends the FSM when the walk runs out of steps.
+inline CoFSM::State walkState(CoFSM::FSM& fsm, const Graph* graph, std::uint32_t index)
+{
+    const std::vector<Edge>& out = graph->edges[index];
+    CoFSM::Event event = co_await fsm.getEvent();
+    while (true) {
+        Walk* pWalk;
+        Walk walk = (event >> pWalk);
+        if (walk.stepsLeft-- == 0)
+            event.destroy();
+        else {
+            const Edge& edge = out[(*walk.choices)[walk.position++ % walk.choices->size()] % out.size()];
+            event.construct(graph->eventNames[edge.eventName], walk);
+        }
+        event = co_await fsm.emitAndReceive(&event);
+    }
+}
+
+// Adds the states and the transitions of the graph to the FSM.
+// The graph must outlive the FSM because the FSM refers to its event names.
+inline void build(CoFSM::FSM& fsm, const Graph& graph)
+{
+    const std::size_t first = fsm.numberOfStates();
+    fsm.addStates(graph.edges.size(), [&](std::size_t i) { return walkState(fsm, &graph, std::uint32_t(i)); });
+    for (std::size_t i = 0; i < graph.edges.size(); ++i)
+        for (const Edge& e : graph.edges[i])
+            fsm.addTransition(fsm.getStateAt(first + i).handle(), graph.eventNames[e.eventName],
+                              fsm.getStateAt(first + e.target).handle());
+}
+
+} // namespace Topology
+#endif // COFSM_TOPOLOGY_H
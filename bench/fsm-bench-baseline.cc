@@ -0,0 +1,627 @@
+// Baselines: the same workloads run on CoFSM and on hand-written state machines.
+// The ping-pong, ring and Morse workloads of the examples are implemented four times:
+//   cofsm   - states are coroutines, transitions go through the FSM's transition table
+//   switch  - the current state is an enum and the dispatch is a switch statement
+//   fnptr   - the current state indexes a table of function pointers
+//   variant - the current state is a std::variant which is dispatched with std::visit
+// All implementations of a workload must produce the same Result or the program throws.
+// Operation = one event handled by a state, so ns/op of cofsm minus that of a baseline
+// is the overhead of the coroutines and the transition table.
+// See Bench.h for the command line options. The results are written in JSON.
+
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+#include <CoFSM.h>
+#include "Bench.h"
+
+using CoFSM::FSM;
+using CoFSM::Event;
+using CoFSM::State;
+using CoFSM::transition;
+
+// Outcome of one run. Every implementation of a workload must agree on it.
+struct Result
+{
+    std::uint64_t activations = 0; // Number of events handled by the states
+    std::uint64_t checksum = 0;    // Workload specific, e.g. the index of the final state
+    bool operator==(const Result&) const = default;
+};
+
+static void validate(const char* workload, const char* impl, const Result& got, const Result& expected)
+{
+    if (got != expected)
+        throw std::runtime_error(std::string(workload) + "/" + impl + ": got " + std::to_string(got.activations) + " activations and checksum " +
+                                 std::to_string(got.checksum) + ", expected " + std::to_string(expected.activations) + " and " +
+                                 std::to_string(expected.checksum));
+}
+
+static std::runtime_error unexpectedEvent(const char* state)
+{
+    return std::runtime_error(std::string("Unexpected event in state ") + state);
+}
+
+// Events of the hand-written machines. The event is recycled like CoFSM::Event.
+enum class Ev : std::uint8_t { None, ToPing, ToPong, Next, TransmitMessage, TransmitSymbol, DoBeep, BeepDone, TransmissionReady };
+
+struct Msg
+{
+    Msg(Ev eventId, std::uint64_t eventValue, std::string eventText = {})
+        : id(eventId), value(eventValue), text(std::move(eventText)) {}
+
+    Ev id = Ev::None;
+    std::uint64_t value = 0;
+    std::string_view symbol;
+    std::string text;
+};
+
+// Helper for std::visit with overloaded lambdas.
+template <class... Fs>
+struct Overloaded : Fs... { using Fs::operator()...; };
+
+//////////////////////////////////////////////////////////////////////////////////////
+// Ping-pong: two states which pass a counter back and forth until it reaches zero.
+// Starts at Ping. Checksum = index of the final state (0 = Ping, 1 = Pong).
+
+static Result pingPongExpected(std::uint64_t count)
+{
+    return {count + 1, count % 2};
+}
+
+static State pingState(FSM& fsm)
+{
+    Event event = co_await fsm.getEvent();
+    while (true) {
+        if (std::uint64_t* pCounter; event == "ToPingEvent") {
+            if (event >> pCounter; *pCounter > 0)
+                event.construct("ToPongEvent", *pCounter - 1);
+            else
+                event.destroy();
+        } else
+            throw unexpectedEvent("ping");
+        event = co_await fsm.emitAndReceive(&event);
+    }
+}
+
+static State pongState(FSM& fsm)
+{
+    Event event = co_await fsm.getEvent();
+    while (true) {
+        if (std::uint64_t* pCounter; event == "ToPongEvent") {
+            if (event >> pCounter; *pCounter > 0)
+                event.construct("ToPingEvent", *pCounter - 1);
+            else
+                event.destroy();
+        } else
+            throw unexpectedEvent("pong");
+        event = co_await fsm.emitAndReceive(&event);
+    }
+}
+
+// The bodies of the states shared by the hand-written machines.
+static void pingStep(Msg& msg)
+{
+    if (msg.id != Ev::ToPing)
+        throw unexpectedEvent("ping");
+    if (msg.value > 0)
+        msg.id = Ev::ToPong, --msg.value;
+    else
+        msg.id = Ev::None;
+}
+
+static void pongStep(Msg& msg)
+{
+    if (msg.id != Ev::ToPong)
+        throw unexpectedEvent("pong");
+    if (msg.value > 0)
+        msg.id = Ev::ToPing, --msg.value;
+    else
+        msg.id = Ev::None;
+}
+
+static void pingPongCoFSM(Bench::Context& ctx, std::uint64_t count)
+{
+    FSM fsm{"PingPong"};
+    fsm << (pingState(fsm) = "ping") << (pongState(fsm) = "pong");
+    fsm << transition("ping", "ToPongEvent", "pong") << transition("pong", "ToPingEvent", "ping");
+    fsm.start().setState("ping");
+
+    Event e;
+    e.construct("ToPingEvent", count);
+    const std::uint64_t before = fsm.transitionCount();
+    ctx.measure(count + 1, [&] { fsm.sendEvent(&e); });
+    validate("ping_pong", "cofsm", {fsm.transitionCount() - before, fsm.findIndex(fsm.currentState())}, pingPongExpected(count));
+}
+
+static void pingPongSwitch(Bench::Context& ctx, std::uint64_t count)
+{
+    enum class St { Ping, Pong } state = St::Ping;
+    Result r;
+    ctx.measure(count + 1, [&] {
+        Msg msg{Ev::ToPing, count};
+        while (msg.id != Ev::None) {
+            ++r.activations;
+            switch (state) {
+            case St::Ping: pingStep(msg); break;
+            case St::Pong: pongStep(msg); break;
+            }
+            switch (msg.id) { // Transition table
+            case Ev::ToPing: state = St::Ping; break;
+            case Ev::ToPong: state = St::Pong; break;
+            default: break;
+            }
+        }
+    });
+    r.checksum = std::uint64_t(state);
+    validate("ping_pong", "switch", r, pingPongExpected(count));
+}
+
+static void pingPongFnPtr(Bench::Context& ctx, std::uint64_t count)
+{
+    // A handler runs the state and returns the index of the next one.
+    using Handler = unsigned (*)(Msg&);
+    static constexpr Handler handlers[] = {
+        [](Msg& msg) { pingStep(msg); return msg.id == Ev::ToPong ? 1u : 0u; },
+        [](Msg& msg) { pongStep(msg); return msg.id == Ev::ToPing ? 0u : 1u; }};
+    unsigned state = 0;
+    Result r;
+    ctx.measure(count + 1, [&] {
+        Msg msg{Ev::ToPing, count};
+        while (msg.id != Ev::None) {
+            ++r.activations;
+            state = handlers[state](msg);
+        }
+    });
+    r.checksum = state;
+    validate("ping_pong", "fnptr", r, pingPongExpected(count));
+}
+
+static void pingPongVariant(Bench::Context& ctx, std::uint64_t count)
+{
+    struct Ping {};
+    struct Pong {};
+    using PingPong = std::variant<Ping, Pong>;
+    PingPong state = Ping{};
+    Result r;
+    ctx.measure(count + 1, [&] {
+        Msg msg{Ev::ToPing, count};
+        while (msg.id != Ev::None) {
+            ++r.activations;
+            state = std::visit(Overloaded{
+                [&](Ping) -> PingPong { pingStep(msg); return msg.id == Ev::ToPong ? PingPong{Pong{}} : PingPong{Ping{}}; },
+                [&](Pong) -> PingPong { pongStep(msg); return msg.id == Ev::ToPing ? PingPong{Ping{}} : PingPong{Pong{}}; }},
+                state);
+        }
+    });
+    r.checksum = state.index();
+    validate("ping_pong", "variant", r, pingPongExpected(count));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+// Ring: N states which pass a hop counter to the next state until it reaches zero.
+// Every state runs the same code, so the hand-written machines look up the next state
+// in a vector which is their counterpart of the transition table.
+// Starts at state 0. Checksum = index of the final state.
+
+static Result ringExpected(std::size_t numStates, std::uint64_t hops)
+{
+    return {hops, (hops - 1) % numStates};
+}
+
+static State ringState(FSM& fsm)
+{
+    Event event = co_await fsm.getEvent();
+    while (true) {
+        std::uint64_t* pHopsLeft;
+        if (event != "NextEvent")
+            throw unexpectedEvent("ring");
+        if (--(event >> pHopsLeft) == 0)
+            event.destroy();
+        event = co_await fsm.emitAndReceive(&event);
+    }
+}
+
+static void ringStep(Msg& msg)
+{
+    if (msg.id != Ev::Next)
+        throw unexpectedEvent("ring");
+    if (--msg.value == 0)
+        msg.id = Ev::None;
+}
+
+static std::vector<std::uint32_t> ringNext(std::size_t numStates)
+{
+    std::vector<std::uint32_t> next(numStates);
+    for (std::size_t i = 0; i < numStates; ++i)
+        next[i] = std::uint32_t((i + 1) % numStates);
+    return next;
+}
+
+static void ringCoFSM(Bench::Context& ctx, std::size_t numStates, std::uint64_t hops)
+{
+    FSM fsm{"Ring"};
+    fsm.addStates(numStates, [&](std::size_t i) { return ringState(fsm) = "ring" + std::to_string(i); });
+    for (std::size_t i = 0; i < numStates; ++i)
+        fsm << transition(fsm.getStateAt(i), "NextEvent", fsm.getStateAt((i + 1) % numStates));
+    fsm.start().setState(fsm.getStateAt(0));
+
+    Event e;
+    e.construct("NextEvent", hops);
+    const std::uint64_t before = fsm.transitionCount();
+    ctx.measure(hops, [&] { fsm.sendEvent(&e); });
+    validate("ring", "cofsm", {fsm.transitionCount() - before, fsm.findIndex(fsm.currentState())}, ringExpected(numStates, hops));
+}
+
+static void ringSwitch(Bench::Context& ctx, std::size_t numStates, std::uint64_t hops)
+{
+    enum class Kind : std::uint8_t { Ring };
+    const std::vector<Kind> kinds(numStates, Kind::Ring);
+    const std::vector<std::uint32_t> next = ringNext(numStates);
+    std::uint32_t state = 0;
+    Result r;
+    ctx.measure(hops, [&] {
+        Msg msg{Ev::Next, hops};
+        while (true) {
+            ++r.activations;
+            switch (kinds[state]) {
+            case Kind::Ring: ringStep(msg); break;
+            }
+            if (msg.id == Ev::None)
+                break;
+            state = next[state];
+        }
+    });
+    r.checksum = state;
+    validate("ring", "switch", r, ringExpected(numStates, hops));
+}
+
+static void ringFnPtr(Bench::Context& ctx, std::size_t numStates, std::uint64_t hops)
+{
+    using Handler = void (*)(Msg&);
+    const std::vector<Handler> handlers(numStates, &ringStep);
+    const std::vector<std::uint32_t> next = ringNext(numStates);
+    std::uint32_t state = 0;
+    Result r;
+    ctx.measure(hops, [&] {
+        Msg msg{Ev::Next, hops};
+        while (true) {
+            ++r.activations;
+            handlers[state](msg);
+            if (msg.id == Ev::None)
+                break;
+            state = next[state];
+        }
+    });
+    r.checksum = state;
+    validate("ring", "fnptr", r, ringExpected(numStates, hops));
+}
+
+static void ringVariant(Bench::Context& ctx, std::size_t numStates, std::uint64_t hops)
+{
+    struct Hop { std::uint32_t index; };
+    struct Stopped { std::uint32_t index; };
+    using Ring = std::variant<Hop, Stopped>;
+    const std::vector<std::uint32_t> next = ringNext(numStates);
+    Ring state = Hop{0};
+    Result r;
+    ctx.measure(hops, [&] {
+        Msg msg{Ev::Next, hops};
+        while (std::holds_alternative<Hop>(state)) {
+            ++r.activations;
+            state = std::visit(Overloaded{
+                [&](Hop h) -> Ring { ringStep(msg); return msg.id == Ev::None ? Ring{Stopped{h.index}} : Ring{Hop{next[h.index]}}; },
+                [](Stopped s) -> Ring { return s; }},
+                state);
+        }
+    });
+    r.checksum = std::get<Stopped>(state).index;
+    validate("ring", "variant", r, ringExpected(numStates, hops));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+// Morse: the three states of the Morse example without the sleeps and the sound.
+// Ready splits a message into symbols, InProgress splits a symbol into dots and dashes
+// and SoundOn "beeps". Instead of sleeping, the states add up the time in dot units.
+// Checksum = total time of the messages in dot units.
+
+static const std::string morseMessage = "SOS SOS THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG 1234567890";
+
+static std::string_view morseCode(char c)
+{
+    static const auto table = [] {
+        std::array<std::string_view, 128> t;
+        t.fill(" ");
+        const char* codes[] = {".-", "-...", "-.-.", "-..", ".", "..-.", "--.", "....", "..", ".---", "-.-", ".-..", "--",
+                               "-.", "---", ".--.", "--.-", ".-.", "...", "-", "..-", "...-", ".--", "-..-", "-.--", "--.."};
+        for (int i = 0; i < 26; ++i)
+            t['A' + i] = codes[i];
+        const char* digits[] = {"-----", ".----", "..---", "...--", "....-", ".....", "-....", "--...", "---..", "----."};
+        for (int i = 0; i < 10; ++i)
+            t['0' + i] = digits[i];
+        return t;
+    }();
+    return table[static_cast<unsigned char>(c) & 127];
+}
+
+static Result morseExpected(std::uint64_t numMessages)
+{
+    Result r{0, 0};
+    for (char c : morseMessage) {
+        std::string_view code = morseCode(c);
+        if (code == " ") {
+            r.activations += 2; // Ready, InProgress
+            r.checksum += 7;
+        } else {
+            r.activations += 2 + 2 * code.size(); // Ready, InProgress and InProgress + SoundOn per signal
+            for (char s : code)
+                r.checksum += (s == '.' ? 1 : 3) + 1;
+            r.checksum += 2;
+        }
+    }
+    r.activations += 1; // Ready receives the last TransmissionReadyEvent.
+    return {r.activations * numMessages, r.checksum * numMessages};
+}
+
+// The state of the hand-written Morse machines.
+struct Morse
+{
+    std::string message;
+    std::size_t symbolsSent = 0;
+    std::string_view symbol;
+    std::size_t signalsSent = 0;
+    std::uint64_t timeUnits = 0;
+};
+
+static void readyStep(Morse& m, Msg& msg)
+{
+    if (msg.id == Ev::TransmitMessage) {
+        m.message = std::move(msg.text);
+        m.symbolsSent = 0;
+    } else if (msg.id == Ev::TransmissionReady) {
+        if (m.symbolsSent == m.message.size())
+            msg.id = Ev::None;
+    } else
+        throw unexpectedEvent("ready");
+    if (m.symbolsSent < m.message.size()) {
+        msg.id = Ev::TransmitSymbol;
+        msg.symbol = morseCode(m.message[m.symbolsSent++]);
+    }
+}
+
+static void inProgressStep(Morse& m, Msg& msg)
+{
+    if (msg.id == Ev::TransmitSymbol) {
+        m.symbol = msg.symbol;
+        m.signalsSent = 0;
+    } else if (msg.id == Ev::BeepDone)
+        m.timeUnits += 1; // Gap between dots and dashes
+    else
+        throw unexpectedEvent("inProgress");
+    if (m.signalsSent < m.symbol.size()) {
+        char signal = m.symbol[m.signalsSent++];
+        if (signal == ' ') { // Gap between words
+            m.signalsSent = m.symbol.size();
+            m.timeUnits += 7;
+            msg.id = Ev::TransmissionReady;
+        } else {
+            msg.id = Ev::DoBeep;
+            msg.value = (signal == '.') ? 1 : 3;
+        }
+    } else { // Gap between symbols
+        m.timeUnits += 2;
+        msg.id = Ev::TransmissionReady;
+    }
+}
+
+static void soundOnStep(Morse& m, Msg& msg)
+{
+    if (msg.id != Ev::DoBeep)
+        throw unexpectedEvent("soundOn");
+    m.timeUnits += msg.value;
+    msg.id = Ev::BeepDone;
+}
+
+static State morseReadyState(FSM& fsm)
+{
+    std::string message;
+    std::size_t symbolsSent = 0;
+    Event event = co_await fsm.getEvent();
+    while (true) {
+        if (std::string* pString; event == "TransmitMessageEvent") {
+            event >> pString;
+            message = std::move(*pString);
+            symbolsSent = 0;
+        } else if (event == "TransmissionReadyEvent") {
+            if (symbolsSent == message.size())
+                event.destroy();
+        } else
+            throw unexpectedEvent("ready");
+        if (symbolsSent < message.size())
+            event.construct("TransmitSymbolEvent", morseCode(message[symbolsSent++]));
+        event = co_await fsm.emitAndReceive(&event);
+    }
+}
+
+static State morseInProgressState(FSM& fsm, std::uint64_t* pTimeUnits)
+{
+    std::string_view symbol;
+    std::size_t signalsSent = 0;
+    Event event = co_await fsm.getEvent();
+    while (true) {
+        if (std::string_view* pSymbol; event == "TransmitSymbolEvent") {
+            symbol = (event >> pSymbol);
+            signalsSent = 0;
+        } else if (event == "BeepDoneEvent")
+            *pTimeUnits += 1;
+        else
+            throw unexpectedEvent("inProgress");
+        if (signalsSent < symbol.size()) {
+            char signal = symbol[signalsSent++];
+            if (signal == ' ') {
+                signalsSent = symbol.size();
+                *pTimeUnits += 7;
+                event.construct("TransmissionReadyEvent");
+            } else
+                event.construct("DoBeepEvent", std::uint64_t(signal == '.' ? 1 : 3));
+        } else {
+            *pTimeUnits += 2;
+            event.construct("TransmissionReadyEvent");
+        }
+        event = co_await fsm.emitAndReceive(&event);
+    }
+}
+
+static State morseSoundOnState(FSM& fsm, std::uint64_t* pTimeUnits)
+{
+    Event event = co_await fsm.getEvent();
+    while (true) {
+        if (std::uint64_t* pBeepTime; event == "DoBeepEvent") {
+            *pTimeUnits += (event >> pBeepTime);
+            event.construct("BeepDoneEvent");
+        } else
+            throw unexpectedEvent("soundOn");
+        event = co_await fsm.emitAndReceive(&event);
+    }
+}
+
+static void morseCoFSM(Bench::Context& ctx, std::uint64_t numMessages)
+{
+    std::uint64_t timeUnits = 0;
+    FSM fsm{"Morse"};
+    fsm << (morseReadyState(fsm) = "ready")
+        << (morseInProgressState(fsm, &timeUnits) = "inProgress")
+        << (morseSoundOnState(fsm, &timeUnits) = "soundOn");
+    fsm << transition("ready", "TransmitSymbolEvent", "inProgress")
+        << transition("inProgress", "DoBeepEvent", "soundOn")
+        << transition("soundOn", "BeepDoneEvent", "inProgress")
+        << transition("inProgress", "TransmissionReadyEvent", "ready");
+    fsm.start().setState("ready");
+
+    const Result expected = morseExpected(numMessages);
+    const std::uint64_t before = fsm.transitionCount();
+    Event e;
+    ctx.measure(expected.activations, [&] {
+        for (std::uint64_t i = 0; i < numMessages; ++i) {
+            e.construct("TransmitMessageEvent", morseMessage);
+            fsm.sendEvent(&e); // The FSM stops at "ready" after each message.
+        }
+    });
+    validate("morse", "cofsm", {fsm.transitionCount() - before, timeUnits}, expected);
+}
+
+static void morseSwitch(Bench::Context& ctx, std::uint64_t numMessages)
+{
+    enum class St { Ready, InProgress, SoundOn };
+    Morse m;
+    Result r;
+    const Result expected = morseExpected(numMessages);
+    ctx.measure(expected.activations, [&] {
+        for (std::uint64_t i = 0; i < numMessages; ++i) {
+            St state = St::Ready;
+            Msg msg{Ev::TransmitMessage, 0, morseMessage};
+            while (msg.id != Ev::None) {
+                ++r.activations;
+                switch (state) {
+                case St::Ready: readyStep(m, msg); break;
+                case St::InProgress: inProgressStep(m, msg); break;
+                case St::SoundOn: soundOnStep(m, msg); break;
+                }
+                switch (msg.id) { // Transition table
+                case Ev::TransmitSymbol: state = St::InProgress; break;
+                case Ev::DoBeep: state = St::SoundOn; break;
+                case Ev::BeepDone: state = St::InProgress; break;
+                case Ev::TransmissionReady: state = St::Ready; break;
+                default: break;
+                }
+            }
+        }
+    });
+    r.checksum = m.timeUnits;
+    validate("morse", "switch", r, expected);
+}
+
+static void morseFnPtr(Bench::Context& ctx, std::uint64_t numMessages)
+{
+    enum : unsigned { Ready, InProgress, SoundOn };
+    using Handler = unsigned (*)(Morse&, Msg&);
+    static constexpr Handler handlers[] = {
+        [](Morse& m, Msg& msg) -> unsigned { readyStep(m, msg); return InProgress; },
+        [](Morse& m, Msg& msg) -> unsigned { inProgressStep(m, msg); return msg.id == Ev::DoBeep ? SoundOn : Ready; },
+        [](Morse& m, Msg& msg) -> unsigned { soundOnStep(m, msg); return InProgress; }};
+    Morse m;
+    Result r;
+    const Result expected = morseExpected(numMessages);
+    ctx.measure(expected.activations, [&] {
+        for (std::uint64_t i = 0; i < numMessages; ++i) {
+            unsigned state = Ready;
+            Msg msg{Ev::TransmitMessage, 0, morseMessage};
+            while (msg.id != Ev::None) {
+                ++r.activations;
+                state = handlers[state](m, msg);
+            }
+        }
+    });
+    r.checksum = m.timeUnits;
+    validate("morse", "fnptr", r, expected);
+}
+
+static void morseVariant(Bench::Context& ctx, std::uint64_t numMessages)
+{
+    struct Ready {};
+    struct InProgress {};
+    struct SoundOn {};
+    using MorseState = std::variant<Ready, InProgress, SoundOn>;
+    Morse m;
+    Result r;
+    const Result expected = morseExpected(numMessages);
+    ctx.measure(expected.activations, [&] {
+        for (std::uint64_t i = 0; i < numMessages; ++i) {
+            MorseState state = Ready{};
+            Msg msg{Ev::TransmitMessage, 0, morseMessage};
+            while (msg.id != Ev::None) {
+                ++r.activations;
+                state = std::visit(Overloaded{
+                    [&](Ready) -> MorseState { readyStep(m, msg); return InProgress{}; },
+                    [&](InProgress) -> MorseState {
+                        inProgressStep(m, msg);
+                        return msg.id == Ev::DoBeep ? MorseState{SoundOn{}} : MorseState{Ready{}}; },
+                    [&](SoundOn) -> MorseState { soundOnStep(m, msg); return InProgress{}; }},
+                    state);
+            }
+        }
+    });
+    r.checksum = m.timeUnits;
+    validate("morse", "variant", r, expected);
+}
+
+int main(int argc, char** argv)
+{
+    Bench::Suite suite("baseline", argc, argv);
+    using Bench::param;
+
+    const std::uint64_t count = suite.quick() ? 100'000 : 10'000'000;
+    suite.add("ping_pong", {param("impl", "cofsm")}, [=](auto& ctx) { pingPongCoFSM(ctx, count); });
+    suite.add("ping_pong", {param("impl", "switch")}, [=](auto& ctx) { pingPongSwitch(ctx, count); });
+    suite.add("ping_pong", {param("impl", "fnptr")}, [=](auto& ctx) { pingPongFnPtr(ctx, count); });
+    suite.add("ping_pong", {param("impl", "variant")}, [=](auto& ctx) { pingPongVariant(ctx, count); });
+
+    for (std::size_t n : {16u, 1024u}) {
+        suite.add("ring", {param("states", n), param("impl", "cofsm")}, [=](auto& ctx) { ringCoFSM(ctx, n, count); });
+        suite.add("ring", {param("states", n), param("impl", "switch")}, [=](auto& ctx) { ringSwitch(ctx, n, count); });
+        suite.add("ring", {param("states", n), param("impl", "fnptr")}, [=](auto& ctx) { ringFnPtr(ctx, n, count); });
+        suite.add("ring", {param("states", n), param("impl", "variant")}, [=](auto& ctx) { ringVariant(ctx, n, count); });
+    }
+
+    const std::uint64_t messages = suite.quick() ? 200 : 20'000;
+    suite.add("morse", {param("impl", "cofsm")}, [=](auto& ctx) { morseCoFSM(ctx, messages); });
+    suite.add("morse", {param("impl", "switch")}, [=](auto& ctx) { morseSwitch(ctx, messages); });
+    suite.add("morse", {param("impl", "fnptr")}, [=](auto& ctx) { morseFnPtr(ctx, messages); });
+    suite.add("morse", {param("impl", "variant")}, [=](auto& ctx) { morseVariant(ctx, messages); });
+
+    return suite.run();
+}
@@ -0,0 +1,279 @@
+// Tail latency from the injection of an event to its handling.
+// An injector sends events at a constant rate. Each event carries the time at which it
+// should have been sent according to the rate and the time at which it was actually sent.
+// The state which handles the event reads the clock as soon as co_await returns the event
+// and records the latency in a Bench::Histogram.
+// The latency from the intended send time is corrected for coordinated omission: if the
+// injector falls behind, the events it could not send in time count as late, too.
+// Delivery modes:
+//   same_thread  - the injector calls sendEvent() on the FSM of the handling state
+//   cross_fsm    - the injector calls sendEvent() on an FSM which passes the event on
+//                  to the handling state in another FSM with a cross-FSM transition
+//   cross_thread - the injector posts the event to a mailbox of a worker thread which
+//                  calls sendEvent() on the FSM of the handling state
+//   inbox        - as cross_thread but through a CoFSM::Inbox, which sheds load if
+//                  the events wait longer than 1 ms for a whole interval of 10 ms
+// Operation = one event. The counters hold the percentiles in nanoseconds
+// of the events which were handled.
+// See Bench.h for the command line options. The results are written in JSON.
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <CoFSM.h>
+#include "Bench.h"
+#include "Histogram.h"
+
+using CoFSM::FSM;
+using CoFSM::Event;
+using CoFSM::State;
+using CoFSM::transition;
+
+static std::uint64_t nowNs()
+{
+    return std::uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// Waits until the given time. Sleeps if there is enough time left and yields otherwise
+// so that the other threads can run even if there are fewer cores than threads.
+static void waitUntil(std::uint64_t timeNs)
+{
+    for (std::uint64_t now = nowNs(); now < timeNs; now = nowNs()) {
+        if (timeNs - now > 200'000)
+            std::this_thread::sleep_for(std::chrono::nanoseconds(timeNs - now - 100'000));
+        else
+            std::this_thread::yield();
+    }
+}
+
+// Payload of the events.
+struct Stamp
+{
+    std::uint64_t intendedNs; // When the event should have been sent
+    std::uint64_t sentNs;     // When the event was sent or posted
+};
+
+// Latencies recorded by the handling states of one thread.
+struct Recorder
+{
+    Bench::Histogram corrected; // From the intended send time
+    Bench::Histogram raw;       // From the actual send time
+};
+
+static State handlerState(FSM& fsm, Recorder* pRecorder)
+{
+    Event event = co_await fsm.getEvent();
+    while (true) {
+        const std::uint64_t now = nowNs();
+        Stamp* pStamp;
+        event >> pStamp;
+        pRecorder->corrected.record(now - pStamp->intendedNs);
+        pRecorder->raw.record(now - pStamp->sentNs);
+        event.destroy();
+        event = co_await fsm.emitAndReceive(&event);
+    }
+}
+
+static State forwardState(FSM& fsm)
+{
+    Event event = co_await fsm.getEvent();
+    while (true)
+        event = co_await fsm.emitAndReceive(&event);
+}
+
+// Mailbox of a worker thread.
+class Mailbox
+{
+public:
+    void post(const Stamp& stamp)
+    {
+        {
+            std::lock_guard lock(_mutex);
+            _queue.push_back(stamp);
+        }
+        _cv.notify_one();
+    }
+
+    void close()
+    {
+        {
+            std::lock_guard lock(_mutex);
+            _bClosed = true;
+        }
+        _cv.notify_one();
+    }
+
+    // Returns false when the mailbox is closed and empty.
+    bool take(Stamp& stamp)
+    {
+        std::unique_lock lock(_mutex);
+        _cv.wait(lock, [this] { return _bClosed || !_queue.empty(); });
+        if (_queue.empty())
+            return false;
+        stamp = _queue.front();
+        _queue.pop_front();
+        return true;
+    }
+
+private:
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque<Stamp> _queue;
+    bool _bClosed = false;
+};
+
+enum class Delivery { SameThread, CrossFsm, CrossThread, Inbox };
+
+// FSMs which deliver events to a handling state.
+struct Target
+{
+    Recorder recorder;
+    std::unique_ptr<FSM> entry, handler;
+
+    Target(Delivery delivery, const std::string& name)
+        : handler(std::make_unique<FSM>(name + ".handler"))
+    {
+        *handler << (handlerState(*handler, &recorder) = "handle");
+        handler->start().setState("handle");
+        if (delivery == Delivery::CrossFsm) {
+            entry = std::make_unique<FSM>(name + ".entry");
+            *entry << (forwardState(*entry) = "forward");
+            *entry << transition("forward", "ProbeEvent", "handle", handler.get());
+            entry->start().setState("forward");
+        }
+    }
+
+    FSM& fsm() { return entry ? *entry : *handler; }
+
+    void send(Event& e, const Stamp& stamp)
+    {
+        e.construct("ProbeEvent", stamp);
+        fsm().sendEvent(&e);
+    }
+};
+
+static void latency(Bench::Context& ctx, Delivery delivery, unsigned numThreads, std::uint64_t rate)
+{
+    const double seconds = ctx.quick() ? 0.02 : 1.0;
+    const std::uint64_t eventsPerInjector = std::max<std::uint64_t>(100, std::uint64_t(double(rate) * seconds));
+    const std::uint64_t interval = 1'000'000'000 / rate;
+
+    std::vector<std::unique_ptr<Target>> targets;
+    for (unsigned t = 0; t < numThreads; ++t)
+        targets.push_back(std::make_unique<Target>(delivery, "Target" + std::to_string(t)));
+
+    const bool bOneInjector = (delivery == Delivery::CrossThread || delivery == Delivery::Inbox);
+    const std::uint64_t numEvents = eventsPerInjector * (bOneInjector ? 1 : numThreads);
+    std::uint64_t shed = 0;
+    ctx.measure(numEvents, [&] {
+        std::vector<std::jthread> threads;
+        if (delivery == Delivery::Inbox) {
+            // One injector which submits to the inboxes of the workers in turns at the given rate.
+            CoFSM::Inbox::Limits limits;
+            limits.target = std::chrono::milliseconds{1};
+            limits.interval = std::chrono::milliseconds{10};
+            std::vector<std::unique_ptr<CoFSM::Inbox>> inboxes;
+            for (unsigned t = 0; t < numThreads; ++t)
+                inboxes.push_back(std::make_unique<CoFSM::Inbox>(&targets[t]->fsm(), limits));
+            std::atomic<bool> bDone = false;
+            for (unsigned t = 0; t < numThreads; ++t)
+                threads.emplace_back([&, t] {
+                    while (!bDone.load() || inboxes[t]->pending() > 0) {
+                        inboxes[t]->wait(std::chrono::milliseconds{1});
+                        inboxes[t]->deliver();
+                    }
+                });
+            Event e;
+            const std::uint64_t start = nowNs();
+            for (std::uint64_t i = 0; i < eventsPerInjector; ++i) {
+                const std::uint64_t intended = start + i * interval;
+                waitUntil(intended);
+                e.construct("ProbeEvent", Stamp{intended, nowNs()});
+                inboxes[i % numThreads]->submit(&e);
+            }
+            bDone = true;
+            threads.clear(); // Join
+            for (auto& inbox : inboxes) {
+                const CoFSM::Inbox::Counters c = inbox->totals();
+                shed += c.shed + c.dropped + c.rejected;
+            }
+        } else if (delivery == Delivery::CrossThread) {
+            // One injector which posts to the workers in turns at the given rate.
+            std::vector<Mailbox> mailboxes(numThreads);
+            for (unsigned t = 0; t < numThreads; ++t)
+                threads.emplace_back([&, t] {
+                    Event e;
+                    for (Stamp stamp; mailboxes[t].take(stamp);)
+                        targets[t]->send(e, stamp);
+                });
+            const std::uint64_t start = nowNs();
+            for (std::uint64_t i = 0; i < eventsPerInjector; ++i) {
+                const std::uint64_t intended = start + i * interval;
+                waitUntil(intended);
+                mailboxes[i % numThreads].post(Stamp{intended, nowNs()});
+            }
+            for (auto& m : mailboxes)
+                m.close();
+            threads.clear(); // Join
+        } else {
+            // Each thread injects to its own FSMs at the given rate.
+            for (unsigned t = 0; t < numThreads; ++t)
+                threads.emplace_back([&, t] {
+                    Event e;
+                    const std::uint64_t start = nowNs();
+                    for (std::uint64_t i = 0; i < eventsPerInjector; ++i) {
+                        const std::uint64_t intended = start + i * interval;
+                        waitUntil(intended);
+                        targets[t]->send(e, Stamp{intended, nowNs()});
+                    }
+                });
+        }
+    });
+
+    Recorder all;
+    for (auto& t : targets) {
+        all.corrected.merge(t->recorder.corrected);
+        all.raw.merge(t->recorder.raw);
+    }
+    if (all.corrected.count() + shed != numEvents)
+        throw std::runtime_error("Recorded " + std::to_string(all.corrected.count()) + " events but sent " + std::to_string(numEvents - shed));
+    ctx.counter("p50_ns", double(all.corrected.percentile(50)));
+    ctx.counter("p99_ns", double(all.corrected.percentile(99)));
+    ctx.counter("p99.9_ns", double(all.corrected.percentile(99.9)));
+    ctx.counter("max_ns", double(all.corrected.max()));
+    ctx.counter("mean_ns", all.corrected.mean());
+    ctx.counter("uncorrected_p99_ns", double(all.raw.percentile(99)));
+    ctx.counter("uncorrected_p99.9_ns", double(all.raw.percentile(99.9)));
+    ctx.counter("achieved_rate", ctx.elapsed() > 0 ? double(numEvents) / ctx.elapsed() : 0.0);
+    if (delivery == Delivery::Inbox)
+        ctx.counter("shed_fraction", double(shed) / double(numEvents));
+}
+
+int main(int argc, char** argv)
+{
+    Bench::Suite suite("latency", argc, argv);
+    using Bench::param;
+
+    const unsigned maxThreads = std::max(2u, std::thread::hardware_concurrency());
+    std::vector<unsigned> threadCounts;
+    for (unsigned n = 1; n < maxThreads; n *= 2)
+        threadCounts.push_back(n);
+    threadCounts.push_back(maxThreads);
+
+    const std::pair<const char*, Delivery> deliveries[] = {
+        {"same_thread", Delivery::SameThread}, {"cross_fsm", Delivery::CrossFsm}, {"cross_thread", Delivery::CrossThread},
+        {"inbox", Delivery::Inbox}};
+    for (const auto& [name, delivery] : deliveries)
+        for (unsigned n : threadCounts)
+            for (std::uint64_t rate : {10'000u, 100'000u, 1'000'000u})
+                suite.add("latency", {param("delivery", name), param("threads", n), param("rate", rate)},
+                          [=](auto& ctx) { latency(ctx, delivery, n, rate); });
+
+    return suite.run();
+}
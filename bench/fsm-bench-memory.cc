@@ -0,0 +1,122 @@
+// Memory footprint of FSMs of increasing size.
+// The global operator new and delete are replaced with the counting versions of
+// CountingHeap.h so that every heap allocation is accounted for. The bytes are broken
+// down with FSM::memoryUsage(): coroutine frames (or bodies of callable states), state names, the vector of states,
+// the transition table (split into nodes and buckets) and event buffers. The resident set size from /proc/self/statm is
+// reported, too, if available.
+// Operation = one state added to the FSM, so ns/op is the build time per state.
+// The interesting numbers are the counters, e.g. "bytes_per_state" and "bytes_per_transition".
+// See Bench.h for the command line options. The results are written in JSON.
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <unistd.h>
+
+#include <CoFSM.h>
+#include "Bench.h"
+#include "CountingHeap.h"
+
+using CoFSM::FSM;
+using CoFSM::Event;
+using CoFSM::State;
+using CoFSM::transition;
+
+// Resident set size in bytes or 0 if not known.
+static std::size_t residentBytes()
+{
+    std::ifstream statm("/proc/self/statm");
+    std::size_t pages = 0, residentPages = 0;
+    if (statm >> pages >> residentPages)
+        return residentPages * std::size_t(sysconf(_SC_PAGESIZE));
+    return 0;
+}
+
+static State idleState(FSM& fsm)
+{
+    Event event = co_await fsm.getEvent();
+    while (true)
+        event = co_await fsm.emitAndReceive(&event);
+}
+
+static constexpr const char* eventNames[] = {"Event0", "Event1", "Event2", "Event3", "Event4", "Event5", "Event6", "Event7"};
+
+// Builds an FSM of the given number of coroutine or callable states where each state
+// has 'degree' transitions to the next states, and reports where the bytes went.
+static void footprint(Bench::Context& ctx, std::size_t numStates, std::size_t degree, bool bCallable)
+{
+    const std::size_t rss0 = residentBytes();
+    const Heap::Snapshot h0 = Heap::Snapshot::take();
+
+    auto fsm = std::make_unique<FSM>("Memory");
+    const Heap::Snapshot h1 = Heap::Snapshot::take();
+
+    std::vector<std::string> names;
+    names.reserve(numStates);
+    for (std::size_t i = 0; i < numStates; ++i)
+        names.push_back("state" + std::to_string(i));
+    const Heap::Snapshot h2 = Heap::Snapshot::take();
+
+    ctx.measure(numStates, [&] {
+        if (bCallable)
+            fsm->addStates(numStates, [&](std::size_t i) { return State([](Event&) {}, names[i]); });
+        else
+            fsm->addStates(numStates, [&](std::size_t i) { return idleState(*fsm) = names[i]; });
+    });
+    const Heap::Snapshot h3 = Heap::Snapshot::take();
+    const CoFSM::MemoryUsage u3 = fsm->memoryUsage();
+
+    for (std::size_t i = 0; i < numStates; ++i)
+        for (std::size_t k = 0; k < degree; ++k)
+            fsm->addTransition(fsm->getStateAt(i), eventNames[k], fsm->getStateAt((i + k + 1) % numStates));
+    const Heap::Snapshot h4 = Heap::Snapshot::take();
+    const CoFSM::MemoryUsage u4 = fsm->memoryUsage();
+
+    // The nodes of the table are the blocks of the most common size added by the transitions.
+    std::size_t nodeSize = 0, numNodes = 0;
+    for (std::size_t s = 0; s < Heap::smallSizes; ++s)
+        if (h4.blocksBySize[s] > h3.blocksBySize[s] && h4.blocksBySize[s] - h3.blocksBySize[s] > numNodes)
+            nodeSize = s, numNodes = h4.blocksBySize[s] - h3.blocksBySize[s];
+    const std::size_t tableNodes = nodeSize * numNodes;
+    const std::size_t tableBuckets = u4.table > tableNodes ? u4.table - tableNodes : 0;
+
+    fsm->start();
+    Event e;
+    e.setMemoryAccount(&fsm->memoryAccount());
+    e.construct("Event0", std::string(64, 'x'));
+    const CoFSM::MemoryUsage u5 = fsm->memoryUsage();
+    const Heap::Snapshot h5 = Heap::Snapshot::take();
+    const std::size_t rss5 = residentBytes();
+
+    const double n = double(numStates), t = double(numStates * degree);
+    ctx.counter("empty_fsm_bytes", double(h1.bytes - h0.bytes));
+    ctx.counter("bytes_per_state", double(h3.bytes - h2.bytes) / n);
+    ctx.counter("frame_bytes_per_state", double(u3.frames) / n);
+    ctx.counter("name_bytes_per_state", double(u3.names) / n);
+    ctx.counter("state_vector_bytes_per_state", double(u3.states) / n);
+    ctx.counter("allocations_per_state", double(h3.allocations - h2.allocations) / n);
+    ctx.counter("bytes_per_transition", double(h4.bytes - h3.bytes) / t);
+    ctx.counter("table_node_bytes_per_transition", double(tableNodes) / t);
+    ctx.counter("table_bucket_bytes_per_transition", double(tableBuckets) / t);
+    ctx.counter("event_buffer_bytes", double(u5.events));
+    ctx.counter("heap_bytes_total", double(h5.bytes - h0.bytes));
+    if (rss0 && rss5 >= rss0)
+        ctx.counter("rss_bytes_per_state", double(rss5 - rss0) / n);
+}
+
+int main(int argc, char** argv)
+{
+    Bench::Suite suite("memory", argc, argv);
+    using Bench::param;
+
+    for (std::size_t n : {1000u, 10000u, 100000u, 1000000u}) {
+        if (suite.quick() && n > 10000)
+            continue;
+        for (std::size_t degree : {1u, 4u})
+            for (bool bCallable : {false, true})
+                suite.add("footprint", {param("states", n), param("transitions_per_state", degree), param("kind", bCallable ? "callable" : "coroutine")},
+                          [=](auto& ctx) { footprint(ctx, n, degree, bCallable); });
+    }
+
+    return suite.run();
+}
@@ -0,0 +1,294 @@
+// Microbenchmarks of the basic operations of CoFSM.
+// See Bench.h for the command line options. The results are written in JSON.
+
+#include <algorithm>
+#include <array>
+#include <iterator>
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+#include <CoFSM.h>
+#include "Bench.h"
+
+using CoFSM::FSM;
+using CoFSM::Event;
+using CoFSM::State;
+using CoFSM::transition;
+
+// A state on a ring. Decrements the hop counter in the payload and passes the event on.
+// Suspends the FSM when the counter reaches zero.
+static State hopState(FSM& fsm)
+{
+    Event event = co_await fsm.getEvent();
+    while (true) {
+        std::uint64_t* pHopsLeft;
+        if (--(event >> pHopsLeft) == 0)
+            event.destroy();
+        event = co_await fsm.emitAndReceive(&event);
+    }
+}
+
+// A state which suspends the FSM right away.
+static State sinkState(FSM& fsm)
+{
+    Event event = co_await fsm.getEvent();
+    while (true) {
+        event.destroy();
+        event = co_await fsm.emitAndReceive(&event);
+    }
+}
+
+// A state which does nothing. Used for benchmarking the configuration.
+static State idleState(FSM& fsm)
+{
+    Event event = co_await fsm.getEvent();
+    while (true)
+        event = co_await fsm.emitAndReceive(&event);
+}
+
+// The same as hopState but as a callable state without a coroutine frame.
+static void hopCallable(Event& event)
+{
+    std::uint64_t* pHopsLeft;
+    if (--(event >> pHopsLeft) == 0)
+        event.destroy();
+}
+
+// Ring of coroutine or callable states within one FSM. Operation = one state transition.
+static void intraFsmTransitions(Bench::Context& ctx, std::size_t numStates, bool bCallable)
+{
+    FSM fsm{"Ring"};
+    fsm.addStates(numStates, [&](std::size_t) { return bCallable ? State(hopCallable) : hopState(fsm); });
+    for (std::size_t i = 0; i < numStates; ++i)
+        fsm << transition(fsm.getStateAt(i), "NextEvent", fsm.getStateAt((i + 1) % numStates));
+    fsm.start().setState(fsm.getStateAt(0));
+
+    const std::uint64_t hops = ctx.quick() ? 100'000 : 10'000'000;
+    Event e;
+    e.construct("NextEvent", hops);
+    ctx.measure(hops, [&] { fsm.sendEvent(&e); });
+}
+
+// Ring of FSMs with one state each. Operation = one transition from an FSM to the next one.
+static void crossFsmTransitions(Bench::Context& ctx, std::size_t numFsms)
+{
+    std::vector<std::unique_ptr<FSM>> fsms;
+    for (std::size_t i = 0; i < numFsms; ++i) {
+        fsms.push_back(std::make_unique<FSM>("FSM" + std::to_string(i)));
+        *fsms.back() << (hopState(*fsms.back()) = "hop");
+    }
+    for (std::size_t i = 0; i < numFsms; ++i)
+        *fsms[i] << transition("hop", "NextEvent", "hop", fsms[(i + 1) % numFsms].get());
+    for (auto& fsm : fsms)
+        fsm->start().setState("hop");
+
+    const std::uint64_t hops = ctx.quick() ? 100'000 : 10'000'000;
+    Event e;
+    e.construct("NextEvent", hops);
+    ctx.measure(hops, [&] { fsms[0]->sendEvent(&e); });
+}
+
+// Payloads of different sizes and kinds.
+template <std::size_t N>
+struct Blob { std::array<std::byte, N> bytes{}; };
+
+// Event::construct into a recycled event. Operation = one construct.
+template <class T>
+static void eventConstruct(Bench::Context& ctx, T value)
+{
+    const std::uint64_t n = ctx.quick() ? 100'000 : 10'000'000;
+    Event e;
+    e.construct("PayloadEvent", value);
+    ctx.measure(n, [&] {
+        for (std::uint64_t i = 0; i < n; ++i) {
+            Bench::doNotOptimize(e.construct("PayloadEvent", value));
+        }
+    });
+}
+
+// Type-checked access to the payload with operator>>. Operation = one extraction.
+template <class T>
+static void eventExtract(Bench::Context& ctx, T value)
+{
+    const std::uint64_t n = ctx.quick() ? 100'000 : 10'000'000;
+    Event e;
+    e.construct("PayloadEvent", value);
+    ctx.measure(n, [&] {
+        for (std::uint64_t i = 0; i < n; ++i) {
+            T* p;
+            e >> p;
+            Bench::doNotOptimize(p);
+        }
+    });
+}
+
+// An external operation which completes at once by resuming the awaiting coroutine.
+struct Immediate
+{
+    bool await_ready() { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> h) { return h; }
+    int await_resume() { return 1; }
+};
+
+// A state which awaits an external operation and then suspends the FSM.
+static State externalSinkState(FSM& fsm)
+{
+    Event event = co_await fsm.getEvent();
+    while (true) {
+        Bench::doNotOptimize(co_await fsm.awaitExternal(Immediate{}));
+        event.destroy();
+        event = co_await fsm.emitAndReceive(&event);
+    }
+}
+
+// Entry into a suspended FSM whose state suspends right away, optionally after awaiting
+// an external operation. Operation = one sendEvent().
+static void sendEventEntry(Bench::Context& ctx, bool bExternal)
+{
+    FSM fsm{"Sink"};
+    fsm << ((bExternal ? externalSinkState(fsm) : sinkState(fsm)) = "sink");
+    fsm.start().setState("sink");
+
+    const std::uint64_t n = ctx.quick() ? 100'000 : 10'000'000;
+    Event e;
+    ctx.measure(n, [&] {
+        for (std::uint64_t i = 0; i < n; ++i) {
+            e.construct("GoEvent");
+            fsm.sendEvent(&e);
+        }
+    });
+}
+
+// A state on a ring which builds a string and a vector while handling each event,
+// either on the heap or in the scratch arena of the FSM.
+static State temporariesState(FSM& fsm, bool bScratch)
+{
+    std::pmr::memory_resource* resource = bScratch ? &fsm.scratch() : std::pmr::new_delete_resource();
+    Event event = co_await fsm.getEvent();
+    while (true) {
+        {
+            std::pmr::string text(64, 'x', resource);
+            std::pmr::vector<std::uint64_t> numbers(16, 1, resource);
+            Bench::doNotOptimize(text);
+            Bench::doNotOptimize(numbers);
+        }
+        std::uint64_t* pHopsLeft;
+        if (--(event >> pHopsLeft) == 0)
+            event.destroy();
+        event = co_await fsm.emitAndReceive(&event);
+    }
+}
+
+// Two states which make temporary containers. Operation = one state transition.
+static void handlerTemporaries(Bench::Context& ctx, bool bScratch)
+{
+    FSM fsm{"Temporaries"};
+    fsm << (temporariesState(fsm, bScratch) = "a") << (temporariesState(fsm, bScratch) = "b");
+    fsm << transition("a", "NextEvent", "b") << transition("b", "NextEvent", "a");
+    fsm.start().setState("a");
+
+    const std::uint64_t hops = ctx.quick() ? 100'000 : 10'000'000;
+    Event e;
+    e.construct("NextEvent", hops);
+    ctx.measure(hops, [&] { fsm.sendEvent(&e); });
+    if (bScratch)
+        ctx.counter("scratch_high_water_bytes", double(fsm.scratch().highWaterMark()));
+}
+
+// Adding a chain of transitions between states identified by handles or by names.
+// Operation = one addTransition().
+static void addTransitions(Bench::Context& ctx, std::size_t numStates, bool bByName)
+{
+    FSM fsm{"Config"};
+    std::vector<std::string> names;
+    for (std::size_t i = 0; i < numStates; ++i)
+        names.push_back("state" + std::to_string(i));
+    fsm.addStates(numStates, [&](std::size_t i) { return idleState(fsm) = names[i]; });
+    ctx.measure(numStates - 1, [&] {
+        for (std::size_t i = 0; i + 1 < numStates; ++i) {
+            if (bByName)
+                fsm.addTransition(names[i], "NextEvent", names[i + 1]);
+            else
+                fsm.addTransition(fsm.getStateAt(i).handle(), "NextEvent", fsm.getStateAt(i + 1).handle());
+        }
+    });
+}
+
+// Finding states by name. Operation = one findIndex().
+static void findState(Bench::Context& ctx, std::size_t numStates)
+{
+    FSM fsm{"Config"};
+    std::vector<std::string> names;
+    for (std::size_t i = 0; i < numStates; ++i)
+        names.push_back("state" + std::to_string(i));
+    fsm.addStates(numStates, [&](std::size_t i) { return idleState(fsm) = names[i]; });
+    const std::size_t lookups = std::min<std::size_t>(numStates, 1000);
+    ctx.measure(lookups, [&] {
+        for (std::size_t i = 0; i < lookups; ++i)
+            Bench::doNotOptimize(fsm.findIndex(names[(i * 7919) % numStates]));
+    });
+}
+
+// Starting N states. Operation = one state resumed from initial suspend.
+static void startStates(Bench::Context& ctx, std::size_t numStates)
+{
+    FSM fsm{"Start"};
+    fsm.addStates(numStates, [&](std::size_t) { return idleState(fsm); });
+    ctx.measure(numStates, [&] { fsm.start(); });
+}
+
+int main(int argc, char** argv)
+{
+    Bench::Suite suite("micro", argc, argv);
+    const bool bQuick = suite.quick();
+    using Bench::param;
+
+    // In quick mode, skip the sizes which take long to set up.
+    auto sizes = [bQuick](std::initializer_list<std::size_t> all) {
+        std::vector<std::size_t> v;
+        std::copy_if(all.begin(), all.end(), std::back_inserter(v), [bQuick](std::size_t n) { return !bQuick || n <= 10000; });
+        return v;
+    };
+
+    for (std::size_t n : sizes({2u, 16u, 1024u, 65536u, 1048576u}))
+        suite.add("intra_fsm_transitions", {param("states", n)}, [n](auto& ctx) { intraFsmTransitions(ctx, n, false); });
+    for (std::size_t n : sizes({2u, 1024u, 1048576u}))
+        suite.add("intra_fsm_transitions", {param("states", n), param("kind", "callable")}, [n](auto& ctx) { intraFsmTransitions(ctx, n, true); });
+    for (std::size_t n : {2u, 16u, 256u})
+        suite.add("cross_fsm_transitions", {param("fsms", n)}, [n](auto& ctx) { crossFsmTransitions(ctx, n); });
+
+    suite.add("event_construct", {param("type", "int"), param("bytes", sizeof(int))},
+              [](auto& ctx) { eventConstruct(ctx, 42); });
+    suite.add("event_construct", {param("type", "blob"), param("bytes", 64)},
+              [](auto& ctx) { eventConstruct(ctx, Blob<64>{}); });
+    suite.add("event_construct", {param("type", "blob"), param("bytes", 1024)},
+              [](auto& ctx) { eventConstruct(ctx, Blob<1024>{}); });
+    suite.add("event_construct", {param("type", "string"), param("bytes", 8)},
+              [](auto& ctx) { eventConstruct(ctx, std::string(8, 'x')); });
+    suite.add("event_construct", {param("type", "string"), param("bytes", 256)},
+              [](auto& ctx) { eventConstruct(ctx, std::string(256, 'x')); });
+    suite.add("event_construct", {param("type", "vector<int>"), param("bytes", 64 * sizeof(int))},
+              [](auto& ctx) { eventConstruct(ctx, std::vector<int>(64)); });
+
+    suite.add("event_extract", {param("type", "int")}, [](auto& ctx) { eventExtract(ctx, 42); });
+    suite.add("event_extract", {param("type", "string")}, [](auto& ctx) { eventExtract(ctx, std::string(256, 'x')); });
+    suite.add("event_extract", {param("type", "vector<int>")}, [](auto& ctx) { eventExtract(ctx, std::vector<int>(64)); });
+
+    suite.add("send_event_entry", {}, [](auto& ctx) { sendEventEntry(ctx, false); });
+    suite.add("send_event_entry", {param("await", "external")}, [](auto& ctx) { sendEventEntry(ctx, true); });
+    suite.add("handler_temporaries", {param("memory", "heap")}, [](auto& ctx) { handlerTemporaries(ctx, false); });
+    suite.add("handler_temporaries", {param("memory", "scratch")}, [](auto& ctx) { handlerTemporaries(ctx, true); });
+
+    for (std::size_t n : sizes({1000u, 10000u, 100000u}))
+        suite.add("add_transition_by_handle", {param("states", n)}, [n](auto& ctx) { addTransitions(ctx, n, false); });
+    for (std::size_t n : sizes({1000u, 10000u}))
+        suite.add("add_transition_by_name", {param("states", n)}, [n](auto& ctx) { addTransitions(ctx, n, true); });
+    for (std::size_t n : sizes({1000u, 10000u, 100000u}))
+        suite.add("find_state", {param("states", n)}, [n](auto& ctx) { findState(ctx, n); });
+
+    for (std::size_t n : sizes({1000u, 100000u}))
+        suite.add("start", {param("states", n)}, [n](auto& ctx) { startStates(ctx, n); });
+
+    return suite.run();
+}
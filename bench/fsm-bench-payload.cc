@@ -0,0 +1,227 @@
+// Throughput of events with different payloads through a two-state FSM.
+// The states pass the event back and forth and handle the payload in one of these ways:
+//   forward  - read the payload with operator>> and send the same event on
+//   inplace  - construct a new payload in place with construct<T>(name, args...)
+//   move     - move the received payload into the event with construct(name, T&&)
+//   fresh    - move the received payload into a new Event object instead of recycling the event
+// Benchmark "reserve_growth" constructs payloads of growing sizes into a fresh or a
+// recycled event, so that Event::reserve() must or must not reallocate the buffer.
+// Benchmark "metadata" runs the int payload with and without an EventMeta header,
+// which the FSM stamps with the source state on every transition.
+// Operation = one state transition (one construct for reserve_growth).
+// Counter "allocations_per_op" tells the number of heap allocations per operation.
+// See Bench.h for the command line options. The results are written in JSON.
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <CoFSM.h>
+#include "Bench.h"
+#include "CountingHeap.h"
+
+using CoFSM::FSM;
+using CoFSM::Event;
+using CoFSM::State;
+using CoFSM::transition;
+
+enum class Mode { Forward, InPlace, Move, Fresh };
+
+static const char* toString(Mode mode)
+{
+    switch (mode) {
+    case Mode::Forward: return "forward";
+    case Mode::InPlace: return "inplace";
+    case Mode::Move: return "move";
+    case Mode::Fresh: return "fresh";
+    }
+    return "?";
+}
+
+// Payload kinds. emplace() constructs the payload in place from constructor arguments.
+struct VoidPayload
+{
+    using T = void;
+    static constexpr const char* name = "void";
+    static void emplace(Event& e) { e.construct<void>("PingEvent"); }
+};
+
+struct IntPayload
+{
+    using T = int;
+    static constexpr const char* name = "int";
+    static void emplace(Event& e) { e.construct<int>("PingEvent", 42); }
+};
+
+static const std::string text(1024, 'x');
+static const std::array<int, 1024> numbers{};
+
+template <std::size_t N>
+struct StringPayload
+{
+    using T = std::string;
+    static constexpr const char* name = "string";
+    static void emplace(Event& e) { e.construct<std::string>("PingEvent", text.data(), N); }
+};
+
+template <std::size_t N>
+struct VectorPayload
+{
+    using T = std::vector<int>;
+    static constexpr const char* name = "vector<int>";
+    static void emplace(Event& e) { e.construct<std::vector<int>>("PingEvent", numbers.begin(), numbers.begin() + N); }
+};
+
+// Not trivially destructible, so the event must call the destructor.
+struct Tracked
+{
+    std::array<std::uint64_t, 4> data{};
+    ~Tracked() { Bench::doNotOptimize(data); }
+};
+
+struct TrackedPayload
+{
+    using T = Tracked;
+    static constexpr const char* name = "non_trivial_dtor";
+    static void emplace(Event& e) { e.construct<Tracked>("PingEvent"); }
+};
+
+struct alignas(64) Aligned
+{
+    std::array<double, 8> values{};
+};
+
+struct AlignedPayload
+{
+    using T = Aligned;
+    static constexpr const char* name = "over_aligned_64";
+    static void emplace(Event& e) { e.construct<Aligned>("PingEvent"); }
+};
+
+// Counts the payloads which are not aligned as their type requires.
+static std::uint64_t misaligned = 0;
+
+template <class Kind>
+static State payloadState(FSM& fsm, Mode mode, std::uint64_t* pHopsLeft)
+{
+    using T = typename Kind::T;
+    Event event = co_await fsm.getEvent();
+    while (true) {
+        if ((*pHopsLeft)-- == 0) {
+            event.destroy();
+        } else if constexpr (std::is_void_v<T>) {
+            if (mode == Mode::InPlace || mode == Mode::Move)
+                Kind::emplace(event);
+            else if (mode == Mode::Fresh) {
+                Event fresh;
+                Kind::emplace(fresh);
+                event = std::move(fresh);
+            }
+        } else {
+            T* p;
+            event >> p;
+            if (reinterpret_cast<std::uintptr_t>(p) % alignof(T))
+                ++misaligned;
+            Bench::doNotOptimize(*p);
+            switch (mode) {
+            case Mode::Forward:
+                break;
+            case Mode::InPlace:
+                Kind::emplace(event);
+                break;
+            case Mode::Move: {
+                T value = std::move(*p);
+                event.construct("PingEvent", std::move(value));
+                break;
+            }
+            case Mode::Fresh: {
+                Event fresh;
+                fresh.construct("PingEvent", std::move(*p));
+                event = std::move(fresh);
+                break;
+            }
+            }
+        }
+        event = co_await fsm.emitAndReceive(&event);
+    }
+}
+
+template <class Kind>
+static void pingPong(Bench::Context& ctx, Mode mode, bool bMeta = false)
+{
+    std::uint64_t hopsLeft = 0;
+    FSM fsm{"Payload"};
+    fsm << (payloadState<Kind>(fsm, mode, &hopsLeft) = "ping") << (payloadState<Kind>(fsm, mode, &hopsLeft) = "pong");
+    fsm << transition("ping", "PingEvent", "pong") << transition("pong", "PingEvent", "ping");
+    fsm.start().setState("ping");
+
+    const std::uint64_t hops = ctx.quick() ? 100'000 : 10'000'000;
+    Event e;
+    if (bMeta)
+        e.enableMeta().sequence = 1;
+    Kind::emplace(e);
+    hopsLeft = hops;
+    misaligned = 0;
+    const std::size_t allocations = Heap::allocations.load();
+    ctx.measure(hops, [&] { fsm.sendEvent(&e); });
+    ctx.counter("allocations_per_op", double(Heap::allocations.load() - allocations) / double(hops));
+    if constexpr (!std::is_void_v<typename Kind::T>)
+        ctx.counter("misaligned_payloads", double(misaligned));
+}
+
+template <std::size_t N>
+struct Blob { std::array<std::byte, N> bytes{}; };
+
+// Constructs payloads of 16, 64, 256 and 1024 bytes into a fresh or a recycled event.
+static void reserveGrowth(Bench::Context& ctx, bool bRecycle)
+{
+    const std::uint64_t rounds = ctx.quick() ? 25'000 : 2'500'000;
+    Event recycled;
+    const std::size_t allocations = Heap::allocations.load();
+    ctx.measure(4 * rounds, [&] {
+        for (std::uint64_t i = 0; i < rounds; ++i) {
+            Event fresh;
+            Event& e = bRecycle ? recycled : fresh;
+            Bench::doNotOptimize(e.construct("GrowEvent", Blob<16>{}));
+            Bench::doNotOptimize(e.construct("GrowEvent", Blob<64>{}));
+            Bench::doNotOptimize(e.construct("GrowEvent", Blob<256>{}));
+            Bench::doNotOptimize(e.construct("GrowEvent", Blob<1024>{}));
+        }
+    });
+    ctx.counter("allocations_per_op", double(Heap::allocations.load() - allocations) / double(4 * rounds));
+    ctx.counter("capacity", double(recycled.capacity()));
+}
+
+template <class Kind>
+static void addPayload(Bench::Suite& suite, std::size_t bytes)
+{
+    for (Mode mode : {Mode::Forward, Mode::InPlace, Mode::Move, Mode::Fresh})
+        suite.add("payload", {Bench::param("type", Kind::name), Bench::param("bytes", bytes), Bench::param("mode", toString(mode))},
+                  [mode](auto& ctx) { pingPong<Kind>(ctx, mode); });
+}
+
+int main(int argc, char** argv)
+{
+    Bench::Suite suite("payload", argc, argv);
+
+    addPayload<VoidPayload>(suite, 0);
+    addPayload<IntPayload>(suite, sizeof(int));
+    addPayload<StringPayload<8>>(suite, 8);
+    addPayload<StringPayload<1024>>(suite, 1024);
+    addPayload<VectorPayload<16>>(suite, 16 * sizeof(int));
+    addPayload<VectorPayload<1024>>(suite, 1024 * sizeof(int));
+    addPayload<TrackedPayload>(suite, sizeof(Tracked));
+    addPayload<AlignedPayload>(suite, sizeof(Aligned));
+
+    for (Mode mode : {Mode::Forward, Mode::InPlace})
+        for (bool bMeta : {false, true})
+            suite.add("metadata", {Bench::param("type", IntPayload::name), Bench::param("mode", toString(mode)), Bench::param("meta", bMeta ? "on" : "off")},
+                      [=](auto& ctx) { pingPong<IntPayload>(ctx, mode, bMeta); });
+
+    suite.add("reserve_growth", {Bench::param("event", "fresh")}, [](auto& ctx) { reserveGrowth(ctx, false); });
+    suite.add("reserve_growth", {Bench::param("event", "recycled")}, [](auto& ctx) { reserveGrowth(ctx, true); });
+
+    return suite.run();
+}
@@ -0,0 +1,199 @@
+// Time and allocations of configuring large FSMs.
+// The operations whose cost depends on the number of states (adding a state with
+// operator<<, which checks that the name is unique, and everything which finds a state
+// by name) are measured for the last 1000 operations on an FSM which already has N states.
+// ns/op growing with N means that building the FSM takes O(N^2) time.
+// The operations of the complete build are measured for smaller N, too.
+// Operation = one call of the benchmarked method. Counter "allocations_per_op" tells
+// the number of heap allocations per call.
+// See Bench.h for the command line options. The results are written in JSON.
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <CoFSM.h>
+#include "Bench.h"
+#include "CountingHeap.h"
+
+using CoFSM::FSM;
+using CoFSM::Event;
+using CoFSM::State;
+using CoFSM::transition;
+
+static State idleState(FSM& fsm)
+{
+    Event event = co_await fsm.getEvent();
+    while (true)
+        event = co_await fsm.emitAndReceive(&event);
+}
+
+static std::vector<std::string> stateNames(std::size_t numStates)
+{
+    std::vector<std::string> names;
+    names.reserve(numStates);
+    for (std::size_t i = 0; i < numStates; ++i)
+        names.push_back("state" + std::to_string(i));
+    return names;
+}
+
+// Times 'operations' calls of body() and reports the allocations.
+template <class F>
+static void measureWithAllocations(Bench::Context& ctx, std::uint64_t operations, F&& body)
+{
+    const std::size_t before = Heap::allocations.load();
+    ctx.measure(operations, body);
+    ctx.counter("allocations_per_op", double(Heap::allocations.load() - before) / double(std::max<std::uint64_t>(operations, 1)));
+}
+
+// Number of operations measured on an FSM which already has N states.
+static std::size_t sampleSize(std::size_t numStates) { return std::min<std::size_t>(numStates, 1000); }
+
+// The FSM has N - K states and the last K states are added with operator<<.
+static void addStateByOperator(Bench::Context& ctx, std::size_t numStates)
+{
+    const std::vector<std::string> names = stateNames(numStates);
+    const std::size_t k = sampleSize(numStates);
+    FSM fsm{"Startup"};
+    fsm.addStates(numStates - k, [&](std::size_t i) { return idleState(fsm) = names[i]; });
+    measureWithAllocations(ctx, k, [&] {
+        for (std::size_t i = numStates - k; i < numStates; ++i)
+            fsm << (idleState(fsm) = names[i]);
+    });
+}
+
+// The FSM has N states which are added with addStates().
+static void addStatesInBulk(Bench::Context& ctx, std::size_t numStates)
+{
+    const std::vector<std::string> names = stateNames(numStates);
+    FSM fsm{"Startup"};
+    measureWithAllocations(ctx, numStates, [&] {
+        fsm.addStates(numStates, [&](std::size_t i) { return idleState(fsm) = names[i]; });
+    });
+}
+
+// K transitions between states which are spread over the FSM, identified by name.
+static void addTransitionByName(Bench::Context& ctx, std::size_t numStates)
+{
+    const std::vector<std::string> names = stateNames(numStates);
+    const std::size_t k = sampleSize(numStates);
+    FSM fsm{"Startup"};
+    fsm.addStates(numStates, [&](std::size_t i) { return idleState(fsm) = names[i]; });
+    measureWithAllocations(ctx, k, [&] {
+        for (std::size_t i = 0; i < k; ++i) {
+            const std::size_t from = (i * 7919) % numStates;
+            fsm << transition(names[from], "NextEvent", names[(from + 1) % numStates]);
+        }
+    });
+}
+
+// N transitions identified by state handles.
+static void addTransitionByHandle(Bench::Context& ctx, std::size_t numStates)
+{
+    FSM fsm{"Startup"};
+    fsm.addStates(numStates, [&](std::size_t) { return idleState(fsm); });
+    measureWithAllocations(ctx, numStates, [&] {
+        for (std::size_t i = 0; i < numStates; ++i)
+            fsm << transition(fsm.getStateAt(i), "NextEvent", fsm.getStateAt((i + 1) % numStates));
+    });
+}
+
+static void startStates(Bench::Context& ctx, std::size_t numStates)
+{
+    FSM fsm{"Startup"};
+    fsm.addStates(numStates, [&](std::size_t) { return idleState(fsm); });
+    measureWithAllocations(ctx, numStates, [&] { fsm.start(); });
+}
+
+// K calls of setState(name) with names which are spread over the FSM.
+static void setStateByName(Bench::Context& ctx, std::size_t numStates)
+{
+    const std::vector<std::string> names = stateNames(numStates);
+    const std::size_t k = sampleSize(numStates);
+    FSM fsm{"Startup"};
+    fsm.addStates(numStates, [&](std::size_t i) { return idleState(fsm) = names[i]; });
+    fsm.start();
+    measureWithAllocations(ctx, k, [&] {
+        for (std::size_t i = 0; i < k; ++i)
+            fsm.setState(names[(i * 7919) % numStates]);
+    });
+}
+
+// K calls of replaceState(name) on a started FSM where every state has a transition.
+// The transition table is not touched but the state is found by name, which takes
+// time linear in N, so ns/op grows with N.
+static void replaceStateByName(Bench::Context& ctx, std::size_t numStates)
+{
+    const std::vector<std::string> names = stateNames(numStates);
+    const std::size_t k = sampleSize(numStates);
+    FSM fsm{"Startup"};
+    fsm.addStates(numStates, [&](std::size_t i) { return idleState(fsm) = names[i]; });
+    for (std::size_t i = 0; i < numStates; ++i)
+        fsm << transition(fsm.getStateAt(i), "NextEvent", fsm.getStateAt((i + 1) % numStates));
+    fsm.start();
+    measureWithAllocations(ctx, k, [&] {
+        for (std::size_t i = 0; i < k; ++i)
+            fsm.replaceState(names[(i * 7919) % numStates], idleState(fsm));
+    });
+}
+
+// As above but the states are given by index. The cost should not depend on N.
+static void replaceStateByIndex(Bench::Context& ctx, std::size_t numStates)
+{
+    const std::size_t k = sampleSize(numStates);
+    FSM fsm{"Startup"};
+    fsm.addStates(numStates, [&](std::size_t) { return idleState(fsm); });
+    for (std::size_t i = 0; i < numStates; ++i)
+        fsm << transition(fsm.getStateAt(i), "NextEvent", fsm.getStateAt((i + 1) % numStates));
+    fsm.start();
+    measureWithAllocations(ctx, k, [&] {
+        for (std::size_t i = 0; i < k; ++i)
+            fsm.replaceState((i * 7919) % numStates, idleState(fsm));
+    });
+}
+
+// The complete build in the way of the examples: states with operator<<,
+// transitions by name, start() and setState(name). Operation = one state.
+static void completeBuild(Bench::Context& ctx, std::size_t numStates)
+{
+    const std::vector<std::string> names = stateNames(numStates);
+    measureWithAllocations(ctx, numStates, [&] {
+        FSM fsm{"Startup"};
+        for (std::size_t i = 0; i < numStates; ++i)
+            fsm << (idleState(fsm) = names[i]);
+        for (std::size_t i = 0; i < numStates; ++i)
+            fsm << transition(names[i], "NextEvent", names[(i + 1) % numStates]);
+        fsm.start().setState(names[0]);
+    });
+}
+
+int main(int argc, char** argv)
+{
+    Bench::Suite suite("startup", argc, argv);
+    using Bench::param;
+
+    std::vector<std::size_t> sizes = {1000, 10000, 100000, 1000000};
+    if (suite.quick())
+        sizes = {1000, 10000};
+
+    using Function = void (*)(Bench::Context&, std::size_t);
+    const std::pair<const char*, Function> benchmarks[] = {
+        {"add_state_operator", addStateByOperator},
+        {"add_states_bulk", addStatesInBulk},
+        {"add_transition_by_name", addTransitionByName},
+        {"add_transition_by_handle", addTransitionByHandle},
+        {"start", startStates},
+        {"set_state_by_name", setStateByName},
+        {"replace_state_by_name", replaceStateByName},
+        {"replace_state_by_index", replaceStateByIndex}};
+    for (const auto& [name, f] : benchmarks)
+        for (std::size_t n : sizes)
+            suite.add(name, {param("states", n)}, [n, f](auto& ctx) { f(ctx, n); });
+
+    // The complete build takes O(N^2) time, so it is run for the smaller sizes only.
+    for (std::size_t n : sizes)
+        if (n <= (suite.quick() ? 1000u : 10000u))
+            suite.add("complete_build", {param("states", n)}, [n](auto& ctx) { completeBuild(ctx, n); });
+
+    return suite.run();
+}
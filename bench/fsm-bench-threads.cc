@@ -0,0 +1,426 @@
+// Scaling of CoFSM with the number of threads.
+// Modes:
+//   independent - each thread drives its own FSM with a ring of states (like the "parallel"
+//                 section of the RGB example)
+//   connected   - each thread drives its own ring of FSMs connected by cross-FSM transitions
+//   migrating   - there is one FSM per thread but in every round each FSM is driven by
+//                 the next thread, so the FSMs move between threads on every sendEvent()
+//   paused      - as independent but the FSMs are in one FSMGroup and another thread
+//                 calls pauseAll() and resumeAll() every 100 microseconds
+//   fair        - the threads run a FairScheduler with four groups of weights 1, 1, 2 and 4,
+//                 each having one FSM which is sent long batches of hops
+//   affinity    - the threads are the workers of an AffinityRunner which runs pairs of FSMs
+//                 passing events back and forth with cross-FSM transitions; the FSMs of a
+//                 pair start on different workers and placement "adaptive" rebalances once
+//                 after a warm-up while "spread" keeps them apart
+//   replicated  - one thread sends events to one FSM whose state has one replica per
+//                 thread; each replica hands a piece of work to a pool of the threads with
+//                 FSM::awaitExternal() so that the replicas work in parallel
+// Every batch of hops starts with a fresh Event so that the allocator is exercised, too.
+// Operation = one state transition. ops_per_sec is the aggregate over all threads and
+// counter "efficiency" is the rate per thread relative to the rate of one thread in the same mode.
+// In mode paused, counters "pause_mean_ns" and "pause_max_ns" tell how long pauseAll() took
+// to bring every FSM to a safe point. In mode fair, counter "max_share_error" is the largest
+// relative deviation of the share of transitions of a group from its share of the weights
+// while every group is backlogged, and "mean_queue_delay_ns" is the mean time from post()
+// to the delivery of a batch. In mode affinity, counter "colocated_pairs" is the fraction of
+// the pairs whose FSMs ended up on the same worker.
+// See Bench.h for the command line options. The results are written in JSON.
+
+#include <atomic>
+#include <barrier>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <latch>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <CoFSM.h>
+#include "Bench.h"
+
+using CoFSM::FSM;
+using CoFSM::Event;
+using CoFSM::State;
+using CoFSM::transition;
+
+// Decrements the hop counter in the payload and passes the event on.
+// Suspends the FSM when the counter reaches zero.
+static State hopState(FSM& fsm)
+{
+    Event event = co_await fsm.getEvent();
+    while (true) {
+        std::uint64_t* pHopsLeft;
+        if (--(event >> pHopsLeft) == 0)
+            event.destroy();
+        event = co_await fsm.emitAndReceive(&event);
+    }
+}
+
+// An FSM with a ring of states.
+static std::unique_ptr<FSM> makeRing(const std::string& name, std::size_t numStates)
+{
+    auto fsm = std::make_unique<FSM>(name);
+    fsm->addStates(numStates, [&](std::size_t) { return hopState(*fsm); });
+    for (std::size_t i = 0; i < numStates; ++i)
+        *fsm << transition(fsm->getStateAt(i), "NextEvent", fsm->getStateAt((i + 1) % numStates));
+    fsm->start().setState(fsm->getStateAt(0));
+    return fsm;
+}
+
+// A ring of FSMs with one state each.
+static std::vector<std::unique_ptr<FSM>> makeConnected(const std::string& name, std::size_t numFsms)
+{
+    std::vector<std::unique_ptr<FSM>> fsms;
+    for (std::size_t i = 0; i < numFsms; ++i) {
+        fsms.push_back(std::make_unique<FSM>(name + "." + std::to_string(i)));
+        *fsms.back() << (hopState(*fsms.back()) = "hop");
+    }
+    for (std::size_t i = 0; i < numFsms; ++i)
+        *fsms[i] << transition("hop", "NextEvent", "hop", fsms[(i + 1) % numFsms].get());
+    for (auto& fsm : fsms)
+        fsm->start().setState("hop");
+    return fsms;
+}
+
+// Sends one batch of hops to the FSM.
+static void runBatch(FSM& fsm, std::uint64_t hops)
+{
+    Event e;
+    e.construct("NextEvent", hops);
+    fsm.sendEvent(&e);
+}
+
+// Rate of one thread per mode. Filled in by the single-threaded runs which come first.
+static std::map<std::string, double> singleThreadRate;
+
+static void reportEfficiency(Bench::Context& ctx, const std::string& mode, unsigned numThreads, std::uint64_t operations)
+{
+    const double rate = ctx.elapsed() > 0 ? double(operations) / ctx.elapsed() : 0.0;
+    ctx.counter("transitions_per_sec_per_thread", rate / numThreads);
+    if (numThreads == 1)
+        singleThreadRate[mode] = rate;
+    if (auto it = singleThreadRate.find(mode); it != singleThreadRate.end() && it->second > 0)
+        ctx.counter("efficiency", rate / numThreads / it->second);
+}
+
+static void independent(Bench::Context& ctx, unsigned numThreads, std::uint64_t batches, std::uint64_t hopsPerBatch)
+{
+    std::vector<std::unique_ptr<FSM>> fsms;
+    for (unsigned t = 0; t < numThreads; ++t)
+        fsms.push_back(makeRing("Ring" + std::to_string(t), 16));
+
+    const std::uint64_t operations = numThreads * batches * hopsPerBatch;
+    ctx.measure(operations, [&] {
+        std::latch go(numThreads);
+        std::vector<std::jthread> threads;
+        for (unsigned t = 0; t < numThreads; ++t)
+            threads.emplace_back([&, t] {
+                go.arrive_and_wait();
+                for (std::uint64_t b = 0; b < batches; ++b)
+                    runBatch(*fsms[t], hopsPerBatch);
+            });
+    });
+    reportEfficiency(ctx, "independent", numThreads, operations);
+}
+
+static void connected(Bench::Context& ctx, unsigned numThreads, std::uint64_t batches, std::uint64_t hopsPerBatch)
+{
+    std::vector<std::vector<std::unique_ptr<FSM>>> groups;
+    for (unsigned t = 0; t < numThreads; ++t)
+        groups.push_back(makeConnected("Group" + std::to_string(t), 4));
+
+    const std::uint64_t operations = numThreads * batches * hopsPerBatch;
+    ctx.measure(operations, [&] {
+        std::latch go(numThreads);
+        std::vector<std::jthread> threads;
+        for (unsigned t = 0; t < numThreads; ++t)
+            threads.emplace_back([&, t] {
+                go.arrive_and_wait();
+                for (std::uint64_t b = 0; b < batches; ++b)
+                    runBatch(*groups[t][0], hopsPerBatch);
+            });
+    });
+    reportEfficiency(ctx, "connected", numThreads, operations);
+}
+
+static void migrating(Bench::Context& ctx, unsigned numThreads, std::uint64_t batches, std::uint64_t hopsPerBatch)
+{
+    std::vector<std::unique_ptr<FSM>> fsms;
+    for (unsigned t = 0; t < numThreads; ++t)
+        fsms.push_back(makeRing("Ring" + std::to_string(t), 16));
+
+    const std::uint64_t operations = numThreads * batches * hopsPerBatch;
+    ctx.measure(operations, [&] {
+        // The barrier hands each FSM over to the next thread after every round.
+        std::barrier round(numThreads);
+        std::vector<std::jthread> threads;
+        for (unsigned t = 0; t < numThreads; ++t)
+            threads.emplace_back([&, t] {
+                for (std::uint64_t b = 0; b < batches; ++b) {
+                    round.arrive_and_wait();
+                    runBatch(*fsms[(t + b) % numThreads], hopsPerBatch);
+                }
+            });
+    });
+    reportEfficiency(ctx, "migrating", numThreads, operations);
+}
+
+static void paused(Bench::Context& ctx, unsigned numThreads, std::uint64_t batches, std::uint64_t hopsPerBatch)
+{
+    std::vector<std::unique_ptr<FSM>> fsms;
+    CoFSM::FSMGroup group;
+    for (unsigned t = 0; t < numThreads; ++t) {
+        fsms.push_back(makeRing("Ring" + std::to_string(t), 16));
+        group.add(*fsms.back());
+    }
+
+    using Clock = std::chrono::steady_clock;
+    std::uint64_t numPauses = 0;
+    Clock::duration totalPause{}, maxPause{};
+    const std::uint64_t operations = numThreads * batches * hopsPerBatch;
+    ctx.measure(operations, [&] {
+        std::atomic<unsigned> running = numThreads;
+        std::latch go(numThreads + 1);
+        std::vector<std::jthread> threads;
+        for (unsigned t = 0; t < numThreads; ++t)
+            threads.emplace_back([&, t] {
+                go.arrive_and_wait();
+                for (std::uint64_t b = 0; b < batches; ++b)
+                    runBatch(*fsms[t], hopsPerBatch);
+                --running;
+            });
+        go.arrive_and_wait();
+        while (running.load() > 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds{100});
+            const Clock::time_point t0 = Clock::now();
+            group.pauseAll();
+            const Clock::duration pause = Clock::now() - t0;
+            group.resumeAll();
+            ++numPauses;
+            totalPause += pause;
+            maxPause = std::max(maxPause, pause);
+        }
+    });
+    reportEfficiency(ctx, "paused", numThreads, operations);
+    ctx.counter("pauses", double(numPauses));
+    if (numPauses > 0) {
+        ctx.counter("pause_mean_ns", double(std::chrono::nanoseconds(totalPause).count()) / double(numPauses));
+        ctx.counter("pause_max_ns", double(std::chrono::nanoseconds(maxPause).count()));
+    }
+}
+
+static void fair(Bench::Context& ctx, unsigned numThreads, std::uint64_t hopsPerThread, std::uint64_t hopsPerBatch)
+{
+    const unsigned weights[] = {1, 1, 2, 4};
+    const unsigned sumOfWeights = 8;
+    std::vector<std::unique_ptr<FSM>> fsms;
+    CoFSM::FairScheduler scheduler(100);
+    // Every group gets the same amount of work, so they all remain backlogged until a quarter
+    // of it has been done, which is when the group of the highest weight has done half of its work.
+    const std::uint64_t operations = numThreads * hopsPerThread;
+    const std::uint64_t batchesPerGroup = 2 * operations / hopsPerBatch;
+    for (unsigned g = 0; g < 4; ++g) {
+        fsms.push_back(makeRing("Fair" + std::to_string(g), 16));
+        scheduler.add(scheduler.addGroup("Fair" + std::to_string(g), weights[g]), *fsms.back());
+        for (std::uint64_t b = 0; b < batchesPerGroup; ++b) {
+            Event e;
+            e.construct("NextEvent", hopsPerBatch);
+            scheduler.post(*fsms.back(), &e);
+        }
+    }
+
+    ctx.measure(operations, [&] {
+        std::atomic<std::uint64_t> done = 0;
+        std::vector<std::jthread> threads;
+        for (unsigned t = 0; t < numThreads; ++t)
+            threads.emplace_back([&] {
+                while (done.load(std::memory_order_relaxed) < operations)
+                    done += scheduler.runSlice();
+            });
+    });
+
+    std::uint64_t total = 0;
+    for (unsigned g = 0; g < 4; ++g)
+        total += scheduler.stats(g).transitions;
+    double maxError = 0, delayNs = 0;
+    std::uint64_t events = 0;
+    for (unsigned g = 0; g < 4; ++g) {
+        const CoFSM::FairScheduler::Stats stats = scheduler.stats(g);
+        const double share = double(stats.transitions) / double(total), fairShare = double(weights[g]) / sumOfWeights;
+        maxError = std::max(maxError, std::abs(share - fairShare) / fairShare);
+        delayNs += double(std::chrono::nanoseconds(stats.totalQueueDelay).count());
+        events += stats.events;
+    }
+    reportEfficiency(ctx, "fair", numThreads, operations);
+    ctx.counter("max_share_error", maxError);
+    ctx.counter("mean_queue_delay_ns", events ? delayNs / double(events) : 0.0);
+}
+
+static void affinity(Bench::Context& ctx, unsigned numThreads, std::uint64_t batches, std::uint64_t hopsPerBatch, bool bAdaptive)
+{
+    // Pair k is FSMs 2k and 2k+1, which the runner initially puts on different workers.
+    std::vector<std::unique_ptr<FSM>> fsms;
+    for (unsigned i = 0; i < 2 * numThreads; ++i) {
+        fsms.push_back(std::make_unique<FSM>("Pair" + std::to_string(i / 2) + "." + std::to_string(i % 2)));
+        *fsms.back() << (hopState(*fsms.back()) = "hop");
+    }
+    for (unsigned i = 0; i < 2 * numThreads; ++i)
+        *fsms[i] << transition("hop", "NextEvent", "hop", fsms[i ^ 1].get());
+    for (auto& fsm : fsms)
+        fsm->start().setState("hop");
+
+    CoFSM::AffinityRunner runner(numThreads, std::chrono::milliseconds{0});
+    for (auto& fsm : fsms)
+        runner.add(*fsm);
+    // Both FSMs of a pair get events from outside, too.
+    auto postBatches = [&](std::uint64_t count) {
+        for (std::uint64_t b = 0; b < count; ++b)
+            for (auto& fsm : fsms) {
+                Event e;
+                e.construct("NextEvent", hopsPerBatch);
+                runner.post(*fsm, &e);
+            }
+    };
+    postBatches(std::max<std::uint64_t>(batches / 10, 1));
+    runner.waitIdle();
+    if (bAdaptive)
+        runner.rebalance();
+
+    const std::uint64_t operations = batches * fsms.size() * hopsPerBatch;
+    ctx.measure(operations, [&] {
+        postBatches(batches);
+        runner.waitIdle();
+    });
+    std::size_t colocated = 0;
+    for (unsigned k = 0; k < numThreads; ++k)
+        colocated += runner.workerOf(*fsms[2 * k]) == runner.workerOf(*fsms[2 * k + 1]);
+    reportEfficiency(ctx, bAdaptive ? "affinity_adaptive" : "affinity_spread", numThreads, operations);
+    ctx.counter("colocated_pairs", double(colocated) / numThreads);
+}
+
+// Threads which resume the coroutines given to them after a piece of work.
+class WorkPool
+{
+public:
+    explicit WorkPool(unsigned numThreads)
+    {
+        for (unsigned t = 0; t < numThreads; ++t)
+            _threads.emplace_back([this](std::stop_token stopToken) {
+                std::unique_lock lock(_mutex);
+                while (_cv.wait(lock, stopToken, [this] { return !_queue.empty(); })) {
+                    const auto [h, rounds] = _queue.front();
+                    _queue.pop_front();
+                    lock.unlock();
+                    std::uint64_t x = rounds;
+                    for (std::uint64_t i = 0; i < rounds; ++i)
+                        x = x * 6364136223846793005u + 1442695040888963407u;
+                    Bench::doNotOptimize(x);
+                    h.resume();
+                    lock.lock();
+                }
+            });
+    }
+
+    // Awaitable which does the given number of rounds of work in a thread of the pool.
+    struct Work
+    {
+        WorkPool* pPool;
+        std::uint64_t rounds;
+        bool await_ready() { return false; }
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            {
+                std::lock_guard lock(pPool->_mutex);
+                pPool->_queue.emplace_back(h, rounds);
+            }
+            pPool->_cv.notify_one();
+        }
+        void await_resume() {}
+    };
+
+    Work work(std::uint64_t rounds) { return Work{this, rounds}; }
+
+private:
+    std::mutex _mutex;
+    std::condition_variable_any _cv;
+    std::deque<std::pair<std::coroutine_handle<>, std::uint64_t>> _queue;
+    std::vector<std::jthread> _threads;
+};
+
+// A replica which gets a piece of work done by the pool for each event.
+static State workerState(FSM& fsm, WorkPool& pool, std::uint64_t rounds, std::atomic<std::uint64_t>* pDone)
+{
+    Event event = co_await fsm.getEvent();
+    while (true) {
+        co_await fsm.awaitExternal(pool.work(rounds));
+        pDone->fetch_add(1, std::memory_order_relaxed);
+        event.destroy();
+        event = co_await fsm.emitAndReceive(&event);
+    }
+}
+
+static void replicated(Bench::Context& ctx, unsigned numThreads, std::uint64_t events, std::uint64_t rounds)
+{
+    WorkPool pool(numThreads);
+    std::atomic<std::uint64_t> done = 0;
+    FSM fsm("Replicated");
+    fsm << State(numThreads, [&](std::size_t) { return workerState(fsm, pool, rounds, &done); }, "work");
+    fsm.start().setState("work");
+
+    ctx.measure(events, [&] {
+        done = 0;
+        Event e;
+        for (std::uint64_t i = 0; i < events; ++i) {
+            e.construct("WorkEvent", i);
+            fsm.sendEvent(&e);
+        }
+        while (done.load(std::memory_order_relaxed) < events || fsm.isBusy())
+            std::this_thread::yield();
+    });
+    reportEfficiency(ctx, "replicated", numThreads, events);
+}
+
+int main(int argc, char** argv)
+{
+    Bench::Suite suite("threads", argc, argv);
+    using Bench::param;
+
+    // 1, 2, 4... up to the number of hardware threads but at least 2.
+    const unsigned maxThreads = std::max(2u, std::thread::hardware_concurrency());
+    std::vector<unsigned> threadCounts;
+    for (unsigned n = 1; n < maxThreads; n *= 2)
+        threadCounts.push_back(n);
+    threadCounts.push_back(maxThreads);
+
+    const std::uint64_t hopsPerThread = suite.quick() ? 100'000 : 10'000'000;
+    const std::uint64_t longBatch = 1000, shortBatch = 100;
+    for (unsigned n : threadCounts)
+        suite.add("independent", {param("threads", n), param("hops_per_batch", longBatch)},
+                  [=](auto& ctx) { independent(ctx, n, hopsPerThread / longBatch, longBatch); });
+    for (unsigned n : threadCounts)
+        suite.add("connected", {param("threads", n), param("hops_per_batch", longBatch)},
+                  [=](auto& ctx) { connected(ctx, n, hopsPerThread / longBatch, longBatch); });
+    for (unsigned n : threadCounts)
+        suite.add("migrating", {param("threads", n), param("hops_per_batch", shortBatch)},
+                  [=](auto& ctx) { migrating(ctx, n, hopsPerThread / shortBatch, shortBatch); });
+    for (unsigned n : threadCounts)
+        suite.add("paused", {param("threads", n), param("hops_per_batch", longBatch)},
+                  [=](auto& ctx) { paused(ctx, n, hopsPerThread / longBatch, longBatch); });
+    for (unsigned n : threadCounts)
+        suite.add("fair", {param("threads", n), param("hops_per_batch", longBatch)},
+                  [=](auto& ctx) { fair(ctx, n, hopsPerThread, longBatch); });
+    for (bool bAdaptive : {false, true})
+        for (unsigned n : threadCounts)
+            suite.add("affinity", {param("threads", n), param("hops_per_batch", shortBatch), param("placement", bAdaptive ? "adaptive" : "spread")},
+                      [=](auto& ctx) { affinity(ctx, n, hopsPerThread / shortBatch / 2, shortBatch, bAdaptive); });
+    for (unsigned n : threadCounts)
+        suite.add("replicated", {param("threads", n), param("work_rounds", 1000)},
+                  [=](auto& ctx) { replicated(ctx, n, hopsPerThread / 100 * n, 1000); });
+
+    return suite.run();
+}
@@ -0,0 +1,75 @@
+// State transitions on synthetic topologies made with Topology.h.
+// Each benchmark builds an FSM of the given shape and walks it with the given workload,
+// which decides the outgoing transition taken by every visited state.
+// Operation = one state transition.
+// See Bench.h for the command line options. The results are written in JSON.
+
+#include <string>
+#include <vector>
+
+#include <CoFSM.h>
+#include "Bench.h"
+#include "Topology.h"
+
+using CoFSM::FSM;
+using CoFSM::Event;
+
+static void walk(Bench::Context& ctx, const Topology::Spec& spec, Topology::Workload kind)
+{
+    const Topology::Graph graph = Topology::generate(spec);
+    const std::vector<std::uint32_t> choices = Topology::workload(kind, 1 << 16, graph.maxOutDegree, spec.seed + 1);
+    FSM fsm{std::string("Topology-") + Topology::toString(spec.shape)};
+    Topology::build(fsm, graph);
+    fsm.start().setState(fsm.getStateAt(0));
+
+    const std::uint64_t steps = ctx.quick() ? 100'000 : 10'000'000;
+    Event e;
+    e.construct("Start", Topology::Walk{&choices, 0, steps});
+    ctx.measure(steps, [&] {
+        fsm.setState(fsm.getStateAt(0)).sendEvent(&e);
+    });
+    ctx.counter("transitions_in_table", double(graph.numTransitions));
+    ctx.counter("distinct_event_names", double(graph.eventNames.size()));
+    ctx.counter("unreachable_states", double(fsm.findUnreachable({fsm.getStateAt(0).getName()}).unreachableStates.size()));
+}
+
+int main(int argc, char** argv)
+{
+    Bench::Suite suite("topology", argc, argv);
+    using Bench::param;
+    using Topology::Shape;
+    using Topology::Workload;
+
+    std::vector<std::pair<std::string, Topology::Spec>> specs;
+    auto spec = [](Shape shape, std::size_t numStates) {
+        Topology::Spec s;
+        s.shape = shape;
+        s.numStates = numStates;
+        return s;
+    };
+    specs.emplace_back("", spec(Shape::Random, 1024));
+    specs.emplace_back("", spec(Shape::Random, suite.quick() ? 8192 : 65536));
+    specs.emplace_back("", spec(Shape::Star, 1024));
+    specs.emplace_back("", spec(Shape::Chain, 1024));
+    specs.emplace_back("", spec(Shape::Full, 64));
+    specs.emplace_back("", spec(Shape::Clusters, 1024));
+    // Short and long event names with many distinct names.
+    for (auto [minLength, maxLength] : {std::pair{4u, 8u}, std::pair{32u, 64u}}) {
+        Topology::Spec s = spec(Shape::Random, 1024);
+        s.eventNames = 1024;
+        s.minNameLength = minLength;
+        s.maxNameLength = maxLength;
+        specs.emplace_back(std::to_string(minLength) + "-" + std::to_string(maxLength), s);
+    }
+
+    for (const auto& [nameLengths, s] : specs)
+        for (Workload kind : {Workload::Uniform, Workload::Zipf, Workload::Bursty}) {
+            Bench::Params params = {param("shape", Topology::toString(s.shape)), param("states", s.numStates),
+                                    param("event_names", s.eventNames), param("workload", Topology::toString(kind))};
+            if (!nameLengths.empty())
+                params.push_back(param("name_length", nameLengths));
+            suite.add("walk", params, [s, kind](auto& ctx) { walk(ctx, s, kind); });
+        }
+
+    return suite.run();
+}
@@ -0,0 +1,121 @@
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <CoFSM.h>
+
+using CoFSM::FSM;
+using CoFSM::Event;
+using CoFSM::AffinityRunner;
+using std::cout;
+
+// Passes the event on until the count in it runs out.
+CoFSM::State statePlayer(FSM& fsm, std::atomic<long>* pHits)
+{
+    Event event = co_await fsm.getEvent();
+    while (true) {
+        ++*pHits;
+        std::uint64_t* pCount;
+        if (--(event >> pCount) == 0)
+            event.destroy();
+        event = co_await fsm.emitAndReceive(&event);
+    }
+}
+
+static void post(AffinityRunner& runner, FSM& fsm, std::uint64_t count)
+{
+    Event event;
+    event.construct("BallEvent", count);
+    runner.post(fsm, &event);
+}
+
+static bool check(bool bOk, const char* what)
+{
+    cout << (bOk ? "OK:   " : "FAIL: ") << what << '\n';
+    return bOk;
+}
+
+int main()
+{
+    using namespace CoFSM;
+    std::atomic<long> hits = 0;
+    std::vector<std::unique_ptr<FSM>> fsms;
+    for (const char* name : {"A", "B", "C", "D"}) {
+        fsms.push_back(std::make_unique<FSM>(name));
+        *fsms.back() << (statePlayer(*fsms.back(), &hits) = "playState");
+    }
+    // A plays with B and C plays with D.
+    FSM &a = *fsms[0], &b = *fsms[1], &c = *fsms[2], &d = *fsms[3];
+    for (auto [from, to] : {std::pair{&a, &b}, {&b, &a}, {&c, &d}, {&d, &c}})
+        *from << transition("playState", "BallEvent", "playState", to);
+    for (auto& fsm : fsms)
+        fsm->start().setState("playState");
+    FSM faulty("Faulty");
+    faulty.addState("failState", [](Event& event) {
+        if (event == "BadEvent")
+            throw std::runtime_error("bad event");
+        event.destroy();
+    });
+    faulty.start().setState("failState");
+
+    bool bOk = true;
+    {
+        // Two workers which are rebalanced only on request. The FSMs start round-robin,
+        // so both pairs are split over the workers.
+        AffinityRunner runner(2, std::chrono::milliseconds{0});
+        for (auto& fsm : fsms)
+            runner.add(*fsm);
+        runner.add(faulty);
+        bOk &= check(runner.workerOf(a) != runner.workerOf(b) && runner.workerOf(c) != runner.workerOf(d),
+                     "the pairs start on different workers");
+
+        // 1. Every posted event is handled when waitIdle() returns.
+        for (int i = 0; i < 200; ++i)
+            for (FSM* fsm : {&a, &c, &b, &d})
+                post(runner, *fsm, 50);
+        runner.waitIdle();
+        bOk &= check(hits == 4 * 200 * 50, "waitIdle() returned after the last transition");
+
+        // 2. The rebalance puts each pair on one worker and the pairs on different workers.
+        runner.rebalance();
+        AffinityRunner::Stats stats = runner.stats();
+        bOk &= check(stats.couplings.size() == 2 && stats.couplings[0].bColocated && stats.couplings[1].bColocated,
+                     "the coupled pairs were found and colocated");
+        bOk &= check(runner.workerOf(a) == runner.workerOf(b) && runner.workerOf(c) == runner.workerOf(d) &&
+                     runner.workerOf(a) != runner.workerOf(c), "each pair runs on a worker of its own");
+
+        // 3. The events are posted from several threads after the move.
+        hits = 0;
+        {
+            std::vector<std::jthread> producers;
+            for (FSM* fsm : {&a, &c})
+                producers.emplace_back([&runner, fsm] {
+                    for (int i = 0; i < 1000; ++i)
+                        post(runner, *fsm, 10);
+                });
+        }
+        runner.waitIdle();
+        bOk &= check(hits == 2 * 1000 * 10, "the events of the producer threads were handled");
+
+        // 4. An exception thrown by a state in a worker is rethrown by waitIdle().
+        Event event;
+        event.construct<void>("BadEvent");
+        runner.post(faulty, &event);
+        event.construct<void>("GoodEvent");
+        runner.post(faulty, &event);
+        bool bThrown = false;
+        try {
+            runner.waitIdle();
+        } catch (const std::runtime_error& e) {
+            bThrown = std::string(e.what()) == "bad event";
+        }
+        bOk &= check(bThrown, "waitIdle() rethrew the exception of the state");
+        post(runner, a, 10);
+        runner.waitIdle();
+        bOk &= check(runner.stats().eventsPerWorker[0] + runner.stats().eventsPerWorker[1] == 4 * 200 + 2 * 1000 + 3,
+                     "the workers went on after the exception");
+    }
+    return bOk ? 0 : 1;
+}
@@ -0,0 +1,103 @@
+#include <iostream>
+#include <string>
+#include <CoFSM.h>
+
+using CoFSM::FSM;
+using CoFSM::Event;
+using std::cout;
+
+// Keeps the sum from one event to the next, so it must be a coroutine.
+CoFSM::State stateSum(FSM& fsm, int* pSum)
+{
+    Event event = co_await fsm.getEvent();
+    while (true) {
+        if (int* pValue; event == "SquareEvent") {
+            event >> pValue;
+            *pSum += *pValue;
+            event.destroy(); // Suspend the FSM until the next text comes.
+            event = co_await fsm.emitAndReceive(&event);
+        }
+        else
+            event = co_await fsm.rejectAndReceive(&event);
+    }
+}
+
+// Receives its events from one FSM and emits them through another one, to which it has not
+// been added. This is a mistake which the FSM detects.
+CoFSM::State stateMisplaced(FSM& fsm, FSM& other)
+{
+    Event event = co_await fsm.getEvent();
+    while (true)
+        event = co_await other.emitAndReceive(&event);
+}
+
+static bool check(bool bOk, const char* what)
+{
+    cout << (bOk ? "OK:   " : "FAIL: ") << what << '\n';
+    return bOk;
+}
+
+int main()
+{
+    using namespace CoFSM;
+    int sum = 0;
+    FSM calc("Calc"), math("Math");
+    // Parsing and squaring keep nothing from one event to the next, so they are callable
+    // states which have no coroutine frame. Squaring lives in another FSM.
+    calc.addState("parseState", [](Event& event) {
+        std::string* pText;
+        event >> pText;
+        event.construct("NumberEvent", std::stoi(*pText));
+    });
+    calc << (stateSum(calc, &sum) = "sumState");
+    math << State([](Event& event) {
+        int* pValue;
+        event >> pValue;
+        event.construct("SquareEvent", *pValue * *pValue);
+    }, "squareState");
+    calc << transition("parseState", "NumberEvent", "squareState", &math);
+    math << transition("squareState", "SquareEvent", "sumState", &calc);
+    calc.start();
+    math.start();
+
+    auto sendText = [&](const char* text) {
+        Event event;
+        event.construct("TextEvent", std::string(text));
+        calc.setState("parseState").sendEvent(&event);
+    };
+
+    // 1. Callable and coroutine states in one FSM and across FSMs.
+    for (const char* text : {"1", "2", "3"})
+        sendText(text);
+    bool bOk = check(sum == 1 + 4 + 9, "the callable states parsed and squared the numbers");
+    bOk &= check(math.findState("squareState").isCallable() && !math.findState("squareState").handle(),
+                 "a callable state has no coroutine handle");
+    bOk &= check(calc.transitionCount() == 6 && math.transitionCount() == 3, "the transitions to callable states were counted");
+
+    // 2. A callable state can be replaced with another one. The transitions stay.
+    math.replaceState("squareState", [](Event& event) {
+        int* pValue;
+        event >> pValue;
+        event.construct("SquareEvent", *pValue * *pValue * *pValue);
+    });
+    sum = 0;
+    sendText("2");
+    bOk &= check(sum == 8, "the replaced state was called");
+
+    // 3. A state coroutine may emit events only through the FSM it has been added to.
+    FSM wrong("Wrong");
+    wrong << (stateMisplaced(wrong, calc) = "misplacedState");
+    wrong.start().setState("misplacedState");
+    Event event;
+    event.construct("TextEvent", std::string("4"));
+    bool bThrown = false;
+    try {
+        wrong.sendEvent(&event);
+    } catch (const std::runtime_error& e) {
+        cout << e.what() << '\n';
+        bThrown = true;
+    }
+    bOk &= check(bThrown, "a state which has not been added to the FSM can not emit through it");
+
+    return bOk ? 0 : 1;
+}
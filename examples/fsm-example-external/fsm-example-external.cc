@@ -0,0 +1,191 @@
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <CoFSM.h>
+
+using CoFSM::FSM;
+using CoFSM::Event;
+using std::cout;
+using namespace std::chrono_literals;
+
+// A pool of one thread which doubles numbers. A job waits until the gate is open,
+// so that events can be sent while a state awaits the job.
+class Pool
+{
+public:
+    std::mutex gate;
+
+    Pool() : _thread([this](std::stop_token stop) { work(stop); }) {}
+
+    ~Pool()
+    {
+        _thread.request_stop();
+        _cv.notify_one();
+    }
+
+    // Awaitable which doubles the number in the thread of the pool and resumes the state there.
+    struct Double
+    {
+        Pool* pool;
+        int value;
+        int result = 0;
+
+        bool await_ready() { return false; }
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            pool->post([this, h] {
+                std::lock_guard lock(pool->gate);
+                result = 2 * value;
+                h.resume();
+            });
+        }
+        int await_resume() { return result; }
+    };
+
+    Double compute(int value) { return Double{this, value}; }
+
+    std::thread::id id() const { return _thread.get_id(); }
+
+private:
+    void post(std::function<void()> job)
+    {
+        std::lock_guard lock(_mutex);
+        _jobs.push_back(std::move(job));
+        _cv.notify_one();
+    }
+
+    void work(std::stop_token stop)
+    {
+        while (true) {
+            std::function<void()> job;
+            {
+                std::unique_lock lock(_mutex);
+                _cv.wait(lock, [&] { return stop.stop_requested() || !_jobs.empty(); });
+                if (_jobs.empty())
+                    return;
+                job = std::move(_jobs.front());
+                _jobs.pop_front();
+            }
+            job();
+        }
+    }
+
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque<std::function<void()>> _jobs;
+    std::jthread _thread;
+};
+
+// What the states saw, written by the thread of the pool.
+struct Results
+{
+    std::vector<int> values;
+    bool bAllInPool = true;
+};
+
+// Doubles the number in the pool and keeps the result.
+CoFSM::State stateDouble(FSM& fsm, Pool* pPool, Results* pResults)
+{
+    Event event = co_await fsm.getEvent();
+    while (true) {
+        int* pValue;
+        event >> pValue;
+        const int result = co_await fsm.awaitExternal(pPool->compute(*pValue));
+        pResults->values.push_back(result);
+        pResults->bAllInPool &= std::this_thread::get_id() == pPool->id();
+        event.destroy();
+        event = co_await fsm.emitAndReceive(&event);
+    }
+}
+
+// Doubles the number in the pool and passes the result on.
+CoFSM::State stateFetch(FSM& fsm, Pool* pPool)
+{
+    Event event = co_await fsm.getEvent();
+    while (true) {
+        int* pValue;
+        event >> pValue;
+        const int result = co_await fsm.awaitExternal(pPool->compute(*pValue));
+        event.construct("ResultEvent", result);
+        event = co_await fsm.emitAndReceive(&event);
+    }
+}
+
+// Keeps the results it receives.
+CoFSM::State stateStore(FSM& fsm, Pool* pPool, Results* pResults)
+{
+    Event event = co_await fsm.getEvent();
+    while (true) {
+        int* pValue;
+        event >> pValue;
+        pResults->values.push_back(*pValue);
+        pResults->bAllInPool &= std::this_thread::get_id() == pPool->id();
+        event.destroy();
+        event = co_await fsm.emitAndReceive(&event);
+    }
+}
+
+static void send(FSM& fsm, int value)
+{
+    Event event;
+    event.construct("NumberEvent", value);
+    fsm.sendEvent(&event);
+}
+
+// Waits until the FSMs have delivered their buffered events and stopped, or a second has passed.
+static bool waitUntilDone(std::initializer_list<const FSM*> fsms)
+{
+    auto isRunning = [](const FSM* fsm) { return fsm->isBusy() || fsm->isActive(); };
+    for (int i = 0; i < 1000 && std::ranges::any_of(fsms, isRunning); ++i)
+        std::this_thread::sleep_for(1ms);
+    return std::ranges::none_of(fsms, isRunning);
+}
+
+static bool check(bool bOk, const char* what)
+{
+    cout << (bOk ? "OK:   " : "FAIL: ") << what << '\n';
+    return bOk;
+}
+
+int main()
+{
+    Pool pool;
+    Results doubled, stored;
+    FSM doubler("Doubler"), fetcher("Fetcher"), store("Store");
+    doubler << (stateDouble(doubler, &pool, &doubled) = "doubleState");
+    fetcher << (stateFetch(fetcher, &pool) = "fetchState");
+    store << (stateStore(store, &pool, &stored) = "storeState");
+    fetcher << CoFSM::transition("fetchState", "ResultEvent", "storeState", &store);
+    doubler.start().setState("doubleState");
+    fetcher.start().setState("fetchState");
+    store.start().setState("storeState");
+
+    // 1. The events sent while the state awaits the pool are buffered and
+    //    delivered in the thread of the pool in the order they were sent.
+    std::unique_lock gate(pool.gate);
+    send(doubler, 1);
+    send(doubler, 2);
+    send(doubler, 3);
+    bool bOk = check(doubler.isBusy() && doubler.numberOfBufferedEvents() == 2, "the FSM is busy and buffers the events");
+    gate.unlock();
+    bOk &= check(waitUntilDone({&doubler}) && doubler.numberOfBufferedEvents() == 0, "the buffered events were delivered");
+    bOk &= check(doubled.values == std::vector{2, 4, 6} && doubled.bAllInPool, "in order, in the thread of the pool");
+
+    // 2. The busy FSM passes the result to another FSM. The thread of the pool delivers
+    //    the events still in the buffer when the other FSM stops.
+    gate.lock();
+    send(fetcher, 10);
+    send(fetcher, 20);
+    send(fetcher, 30);
+    bOk &= check(fetcher.numberOfBufferedEvents() == 2, "the events for the busy fetcher are buffered");
+    gate.unlock();
+    bOk &= check(waitUntilDone({&fetcher, &store}) && fetcher.numberOfBufferedEvents() == 0,
+                 "the buffered events were delivered without another sendEvent()");
+    bOk &= check(stored.values == std::vector{20, 40, 60} && stored.bAllInPool, "the store got every result in order");
+    return bOk ? 0 : 1;
+}
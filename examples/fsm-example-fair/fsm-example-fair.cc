@@ -0,0 +1,105 @@
+#include <iostream>
+#include <thread>
+#include <CoFSM.h>
+
+using CoFSM::FSM;
+using CoFSM::Event;
+using CoFSM::FairScheduler;
+using std::cout;
+using namespace std::chrono_literals;
+
+// Passes the event on until the count in it runs out.
+CoFSM::State statePlayer(FSM& fsm)
+{
+    Event event = co_await fsm.getEvent();
+    while (true) {
+        int* pCount;
+        if (--(event >> pCount) == 0)
+            event.destroy(); // Suspend the FSM until the next event comes.
+        event = co_await fsm.emitAndReceive(&event);
+    }
+}
+
+static void post(FairScheduler& scheduler, FSM& fsm, int count)
+{
+    Event event;
+    event.construct("BallEvent", count);
+    scheduler.post(fsm, &event);
+}
+
+static bool check(bool bOk, const char* what)
+{
+    cout << (bOk ? "OK:   " : "FAIL: ") << what << '\n';
+    return bOk;
+}
+
+int main()
+{
+    using namespace CoFSM;
+    FSM bronzeFSM("Bronze"), goldFSM("Gold"), ping("Ping"), pong("Pong");
+    for (FSM* fsm : {&bronzeFSM, &goldFSM}) {
+        *fsm << (statePlayer(*fsm) = "playState") << transition("playState", "BallEvent", "playState");
+        fsm->start().setState("playState");
+    }
+    ping << (statePlayer(ping) = "pingState");
+    pong << (statePlayer(pong) = "pongState");
+    ping << transition("pingState", "BallEvent", "pongState", &pong);
+    pong << transition("pongState", "BallEvent", "pingState", &ping);
+    ping.start().setState("pingState");
+    pong.start().setState("pongState");
+
+    // 1. Two busy groups share the thread by their weights. The turns are run one by one here.
+    bool bOk = true;
+    {
+        FairScheduler scheduler(100);
+        const std::size_t bronze = scheduler.addGroup("bronze", 1), gold = scheduler.addGroup("gold", 3);
+        scheduler.add(bronze, bronzeFSM);
+        scheduler.add(gold, goldFSM);
+        post(scheduler, bronzeFSM, 100000);
+        post(scheduler, goldFSM, 100000);
+        for (int i = 0; i < 20; ++i)
+            scheduler.runSlice();
+        const FairScheduler::Stats statsBronze = scheduler.stats(bronze), statsGold = scheduler.stats(gold);
+        cout << "bronze: " << statsBronze.transitions << " transitions, gold: " << statsGold.transitions << " transitions\n";
+        bOk &= check(statsGold.transitions == 3 * statsBronze.transitions && statsBronze.turns == 10, "the transitions were shared 1:3");
+        bOk &= check(statsBronze.preemptions == 10 && statsBronze.pending == 1, "a long chain was preempted on every turn");
+    } // The pending events are destroyed with the scheduler.
+
+    // 2. Ping and Pong are in different groups. The transitions of a chain which Ping starts
+    //    are charged to the group of Ping, also when Pong runs them.
+    {
+        FairScheduler scheduler(10);
+        const std::size_t left = scheduler.addGroup("left"), right = scheduler.addGroup("right");
+        scheduler.add(left, ping);
+        scheduler.add(right, pong);
+        post(scheduler, ping, 1000);
+        while (scheduler.runSlice() > 0)
+            ;
+        FairScheduler::Stats statsLeft = scheduler.stats(left), statsRight = scheduler.stats(right);
+        bOk &= check(statsLeft.transitions == 1000 && statsLeft.preemptions > 0 && statsRight.transitions == 0,
+                     "a chain across groups was charged to the group which started it");
+        bOk &= check(!ping.isActive() && !pong.isActive() && statsLeft.pending == 0, "the chain ran to its end");
+        post(scheduler, pong, 10);
+        while (scheduler.runSlice() > 0)
+            ;
+        statsRight = scheduler.stats(right);
+        bOk &= check(statsRight.transitions == 10 && statsRight.events == 1, "Pong took events of its own group afterwards");
+    }
+
+    // 3. A worker thread runs the turns while events are posted from this thread.
+    {
+        FairScheduler scheduler(100);
+        const std::size_t group = scheduler.addGroup("only");
+        scheduler.add(group, goldFSM);
+        goldFSM.setState("playState");
+        std::jthread worker([&](std::stop_token stop) { scheduler.run(stop); });
+        for (int i = 0; i < 100; ++i)
+            post(scheduler, goldFSM, 5);
+        while (scheduler.stats(group).transitions < 500)
+            std::this_thread::sleep_for(1ms);
+        worker.request_stop();
+        worker.join();
+        bOk &= check(scheduler.stats(group).events == 100, "the worker thread delivered every event");
+    }
+    return bOk ? 0 : 1;
+}
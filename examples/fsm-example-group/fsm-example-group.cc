@@ -0,0 +1,100 @@
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <CoFSM.h>
+
+using CoFSM::FSM;
+using CoFSM::Event;
+using std::cout;
+using namespace std::chrono_literals;
+
+// Passes the ball on forever and counts the hits.
+CoFSM::State statePlayer(FSM& fsm, std::atomic<long>* pHits)
+{
+    Event event = co_await fsm.getEvent();
+    while (true) {
+        ++*pHits;
+        event = co_await fsm.emitAndReceive(&event);
+    }
+}
+
+// Counts the events and waits for the next one.
+CoFSM::State stateCounter(FSM& fsm, std::atomic<int>* pCount)
+{
+    Event event = co_await fsm.getEvent();
+    while (true) {
+        ++*pCount;
+        event.destroy();
+        event = co_await fsm.emitAndReceive(&event);
+    }
+}
+
+static bool check(bool bOk, const char* what)
+{
+    cout << (bOk ? "OK:   " : "FAIL: ") << what << '\n';
+    return bOk;
+}
+
+int main()
+{
+    using namespace CoFSM;
+    std::atomic<long> hits = 0;
+    std::atomic<int> count = 0;
+    FSM ping("Ping"), pong("Pong"), counter("Counter");
+    ping << (statePlayer(ping, &hits) = "pingState");
+    pong << (statePlayer(pong, &hits) = "pongState");
+    counter << (stateCounter(counter, &count) = "countState");
+    ping << transition("pingState", "BallEvent", "pongState", &pong);
+    pong << transition("pongState", "BallEvent", "pingState", &ping);
+    ping.start().setState("pingState");
+    pong.start();
+    counter.start().setState("countState");
+
+    FSMGroup group;
+    group.add(ping);
+    group.add(pong);
+    group.add(counter);
+
+    // The ball flies between Ping and Pong in another thread until it is stopped.
+    std::jthread player([&] {
+        Event event;
+        event.construct<void>("BallEvent");
+        ping.sendEvent(&event);
+    });
+    while (hits < 1000)
+        std::this_thread::yield();
+
+    // 1. The player parks at a transition boundary and the idle counter needs no parking.
+    group.pauseAll();
+    const long hitsAtPause = hits;
+    std::this_thread::sleep_for(20ms);
+    bool bOk = check(group.isPaused() && group.numberOfParked() == 1, "the running FSM parked");
+    bOk &= check(hits == hitsAtPause, "no state ran while the group was paused");
+
+    // 2. sendEvent() to a member blocks while the group is paused.
+    std::jthread sender([&] {
+        Event event;
+        event.construct<void>("CountEvent");
+        counter.sendEvent(&event);
+    });
+    std::this_thread::sleep_for(20ms);
+    bOk &= check(count == 0, "the event waits until the group is resumed");
+
+    // 3. The paused FSMs can be reconfigured. The ball goes to a state which stops the game.
+    pong.addState("stopState", [](Event& event) { event.destroy(); });
+    pong >> transition("pongState", "BallEvent", "pingState", &ping);
+    pong << transition("pongState", "BallEvent", "stopState");
+    ping >> transition("pingState", "BallEvent", "pongState", &pong);
+    ping << transition("pingState", "BallEvent", "stopState", &pong);
+    group.resumeAll();
+    player.join();
+    sender.join();
+    bOk &= check(!group.isPaused() && count == 1, "the waiting event was delivered after resumeAll()");
+    bOk &= check(hits - hitsAtPause <= 1 && pong.currentState() == "stopState", "the game stopped with the new transitions");
+
+    // 4. A group of stopped FSMs pauses at once.
+    group.pauseAll();
+    bOk &= check(group.numberOfParked() == 0, "no FSM had to park");
+    group.resumeAll();
+    return bOk ? 0 : 1;
+}
@@ -0,0 +1,116 @@
+#include <iostream>
+#include <string>
+#include <thread>
+#include <CoFSM.h>
+
+using CoFSM::FSM;
+using CoFSM::Event;
+using CoFSM::Inbox;
+using std::cout;
+using namespace std::chrono_literals;
+
+// Serves any event, taking *pDelay to do it, and waits for the next one.
+CoFSM::State stateServe(FSM& fsm, const std::chrono::milliseconds* pDelay, int* pServed)
+{
+    Event event = co_await fsm.getEvent();
+    while (true) {
+        std::this_thread::sleep_for(*pDelay);
+        ++*pServed;
+        event.destroy();
+        event = co_await fsm.emitAndReceive(&event);
+    }
+}
+
+static bool check(bool bOk, const char* what)
+{
+    cout << (bOk ? "OK:   " : "FAIL: ") << what << '\n';
+    return bOk;
+}
+
+int main()
+{
+    std::chrono::milliseconds delay = 0ms;
+    int served = 0;
+    FSM fsm("Server");
+    fsm << (stateServe(fsm, &delay, &served) = "serveState");
+    fsm.start().setState("serveState");
+    Event event;
+
+    // 1. Token bucket: three events at once, and about one per second after that.
+    {
+        Inbox inbox(&fsm, Inbox::Limits{.rate = 1, .burst = 3});
+        inbox.setPolicy(std::string("Request") + "Event", Inbox::Overload::Reject); // The name is copied.
+        inbox.setPolicy("StopEvent", Inbox::Overload::Exempt);
+        int accepted = 0, dropped = 0;
+        for (int i = 0; i < 5; ++i) {
+            event.construct<void>("DataEvent");
+            Inbox::Admission admission = inbox.submit(&event);
+            accepted += admission == Inbox::Admission::Accepted;
+            dropped += admission == Inbox::Admission::Dropped;
+        }
+        bool bOk = check(accepted == 3 && dropped == 2 && event.isEmpty(), "the burst was admitted and the rest dropped");
+        event.construct<void>("RequestEvent");
+        bOk &= check(inbox.submit(&event) == Inbox::Admission::Rejected && event == "RequestEvent",
+                     "a rejected event is left to the caller");
+        event.construct<void>("StopEvent");
+        bOk &= check(inbox.submit(&event) == Inbox::Admission::Accepted, "an exempt event is admitted over the limits");
+        bOk &= check(inbox.deliver() == 4 && served == 4 && inbox.pending() == 0, "the admitted events were delivered");
+        Inbox::Counters data = inbox.counters("DataEvent");
+        bOk &= check(data.submitted == 5 && data.delivered == 3 && data.dropped == 2, "the counters of a class add up");
+        if (!bOk)
+            return 1;
+    }
+
+    // 2. The capacity of the queue.
+    {
+        Inbox inbox(&fsm, Inbox::Limits{.capacity = 2});
+        for (int i = 0; i < 4; ++i) {
+            event.construct<void>("DataEvent");
+            inbox.submit(&event);
+        }
+        Inbox::Counters totals = inbox.totals();
+        if (!check(inbox.pending() == 2 && totals.dropped == 2, "the events which do not fit in the queue were dropped"))
+            return 1;
+        inbox.deliver();
+    }
+
+    // 3. Load shedding: the events wait longer than the target for a whole interval,
+    //    so the inbox drops events from the queue, but never the exempt ones.
+    {
+        delay = 2ms;
+        served = 0;
+        Inbox inbox(&fsm, Inbox::Limits{.target = 1ms, .interval = 5ms});
+        inbox.setPolicy("StopEvent", Inbox::Overload::Exempt);
+        for (int i = 0; i < 100; ++i) {
+            event.construct<void>(i % 10 == 0 ? "StopEvent" : "DataEvent");
+            inbox.submit(&event);
+        }
+        inbox.deliver();
+        Inbox::Counters data = inbox.counters("DataEvent"), stop = inbox.counters("StopEvent");
+        bool bOk = check(data.shed > 0 && data.delivered + data.shed == 90, "data events were shed from the queue");
+        bOk &= check(stop.delivered == 10 && stop.shed == 0, "every exempt event was delivered");
+        bOk &= check(served == int(data.delivered + stop.delivered), "only the delivered events were served");
+        if (!bOk)
+            return 1;
+    }
+
+    // 4. Producers in another thread. The thread which runs the FSM delivers.
+    {
+        delay = 0ms;
+        served = 0;
+        Inbox inbox(&fsm);
+        std::jthread producer([&inbox] {
+            Event event;
+            for (int i = 0; i < 1000; ++i) {
+                event.construct<void>(i == 999 ? "StopEvent" : "DataEvent");
+                inbox.submit(&event);
+            }
+        });
+        while (inbox.counters("StopEvent").delivered == 0)
+            if (inbox.wait(10ms))
+                inbox.deliver();
+        if (!check(served == 1000 && inbox.totals().delivered == 1000, "the events of the producer were delivered in this thread"))
+            return 1;
+    }
+    return 0;
+}
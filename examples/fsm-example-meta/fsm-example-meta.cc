@@ -0,0 +1,115 @@
+#include <iostream>
+#include <string>
+#include <CoFSM.h>
+
+using CoFSM::FSM;
+using CoFSM::Event;
+using CoFSM::EventMeta;
+using std::cout;
+
+// What the sink saw in the metadata of the latest event.
+struct Seen
+{
+    bool bHasMeta = false;
+    EventMeta meta;
+    std::string sourceFsm;
+    std::size_t capacity = 0;
+    int value = 0;
+};
+
+// Doubles the number. The payload is replaced but the metadata stays.
+CoFSM::State stateDouble(FSM& fsm)
+{
+    Event event = co_await fsm.getEvent();
+    while (true) {
+        int* pValue;
+        event >> pValue;
+        event.construct("NumberEvent", *pValue * 2);
+        event = co_await fsm.emitAndReceive(&event);
+    }
+}
+
+// Adds one to the number.
+CoFSM::State stateIncrement(FSM& fsm)
+{
+    Event event = co_await fsm.getEvent();
+    while (true) {
+        int* pValue;
+        event >> pValue;
+        ++*pValue;
+        event = co_await fsm.emitAndReceive(&event);
+    }
+}
+
+// Records the metadata of the events it receives.
+CoFSM::State stateSink(FSM& fsm, Seen* pSeen)
+{
+    Event event = co_await fsm.getEvent();
+    while (true) {
+        int* pValue;
+        event >> pValue;
+        pSeen->value = *pValue;
+        pSeen->capacity = event.capacity();
+        pSeen->bHasMeta = event.meta() != nullptr;
+        if (const EventMeta* pMeta = event.meta()) {
+            pSeen->meta = *pMeta;
+            pSeen->sourceFsm = pMeta->sourceFsm ? pMeta->sourceFsm->name() : "";
+        }
+        event.destroy();
+        event = co_await fsm.emitAndReceive(&event);
+    }
+}
+
+static bool check(bool bOk, const char* what)
+{
+    cout << (bOk ? "OK:   " : "FAIL: ") << what << '\n';
+    return bOk;
+}
+
+int main()
+{
+    using namespace CoFSM;
+    Seen seen;
+    FSM front("Front"), back("Back");
+    front << (stateDouble(front) = "doubleState");
+    const std::size_t incrementIndex = front.addState(stateIncrement(front) = "incrementState");
+    back << (stateSink(back, &seen) = "sinkState");
+    front << transition("doubleState", "NumberEvent", "incrementState")
+          << transition("incrementState", "NumberEvent", "sinkState", &back);
+    front.start();
+    back.start();
+
+    // 1. The metadata travels with the event through the states and across FSMs.
+    Event event;
+    event.construct("NumberEvent", 20);
+    const std::size_t capacity = event.capacity();
+    EventMeta& meta = event.enableMeta();
+    meta.traceId = {0x1234, 0x5678};
+    meta.sequence = 7;
+    bool bOk = check(event.capacity() == capacity, "enabling the metadata did not touch the storage of the payload");
+    front.setState("doubleState").sendEvent(&event);
+    bOk &= check(seen.value == 41 && seen.bHasMeta, "the event arrived with its metadata");
+    bOk &= check(seen.meta.traceId[0] == 0x1234 && seen.meta.traceId[1] == 0x5678 && seen.meta.sequence == 7,
+                 "the trace id and the sequence number were kept");
+    bOk &= check(seen.sourceFsm == "Front" && seen.meta.sourceState == incrementIndex,
+                 "the source is the state which emitted the event most recently");
+
+    // 2. An inbox stamps the time the event was queued.
+    Inbox inbox(&front);
+    event.construct("NumberEvent", 1);
+    event.enableMeta().sequence = 8;
+    const auto beforeSubmit = std::chrono::steady_clock::now();
+    inbox.submit(&event);
+    front.setState("doubleState");
+    inbox.deliver();
+    bOk &= check(seen.value == 3 && seen.meta.sequence == 8 && seen.meta.enqueued >= beforeSubmit,
+                 "the inbox stamped the enqueue time");
+
+    // 3. The FSM does not give metadata to an event which has none.
+    Event plain;
+    plain.construct("NumberEvent", 5);
+    front.setState("doubleState").sendEvent(&plain);
+    bOk &= check(seen.value == 11 && !seen.bHasMeta, "an event without metadata stays without it");
+
+    return bOk ? 0 : 1;
+}
@@ -0,0 +1,80 @@
+#include <iostream>
+#include <thread>
+#include <CoFSM.h>
+
+using CoFSM::FSM;
+using CoFSM::Event;
+using std::cout;
+
+// Emits the squares of the numbers it receives to port "squares" and the numbers
+// which are divisible by 10 to port "tens" without suspending.
+CoFSM::State stateSquare(FSM& fsm)
+{
+    auto& squares = fsm.outputPort<long>("squares"); // Look the port up once.
+    Event event = co_await fsm.getEvent();
+    while (true) {
+        int* pValue;
+        event >> pValue;
+        // Retry until the consumer has made room so that no value is lost.
+        // Each failed attempt counts as a dropped value.
+        while (!squares.emitOut(long(*pValue) * *pValue))
+            std::this_thread::yield();
+        if (*pValue % 10 == 0)
+            fsm.emitOut<std::string>("tens", std::to_string(*pValue)); // Looked up by name.
+        event.destroy();
+        event = co_await fsm.emitAndReceive(&event);
+    }
+}
+
+static bool check(bool bOk, const char* what)
+{
+    cout << (bOk ? "OK:   " : "FAIL: ") << what << '\n';
+    return bOk;
+}
+
+int main()
+{
+    using namespace CoFSM;
+    constexpr int numValues = 100000;
+    FSM fsm("Squares");
+    auto& squares = fsm.addOutputPort<long>("squares", 1000);
+    auto& tens = fsm.addOutputPort<std::string>("tens", 4);
+    fsm << (stateSquare(fsm) = "squareState");
+    fsm.start().setState("squareState");
+
+    // The consumer drains the squares in another thread while the FSM produces them.
+    std::vector<long> received;
+    std::jthread consumer([&] {
+        while (received.size() < numValues)
+            if (squares.drain([&](long&& x) { received.push_back(x); }, 64) == 0)
+                std::this_thread::yield();
+    });
+    Event event;
+    for (int i = 1; i <= numValues; ++i) {
+        event.construct("NumberEvent", i);
+        fsm.sendEvent(&event);
+    }
+    consumer.join();
+
+    bool bOk = check(squares.capacity() == 1024, "the capacity was rounded up to a power of two");
+    bool bInOrder = true;
+    for (int i = 0; i < numValues; ++i)
+        bInOrder &= (received[i] == long(i + 1) * (i + 1));
+    bOk &= check(bInOrder, "every square was received in order");
+    // Port "tens" was never drained, so only the first four values fit.
+    bOk &= check(tens.size() == 4 && tens.dropped() == numValues / 10 - 4, "the values which did not fit were dropped and counted");
+    std::string first;
+    tens.drain([&](std::string&& s) { first = s; }, 1);
+    bOk &= check(first == "10" && tens.size() == 3, "drain() takes the oldest value first");
+
+    // With a callback, the values skip the queue.
+    long sum = 0;
+    squares.setCallback([&](long&& x) { sum += x; });
+    for (int i = 1; i <= 3; ++i) {
+        event.construct("NumberEvent", i);
+        fsm.sendEvent(&event);
+    }
+    bOk &= check(sum == 1 + 4 + 9 && squares.size() == 0, "the callback received the values");
+
+    return bOk ? 0 : 1;
+}
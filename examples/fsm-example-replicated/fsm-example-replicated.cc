@@ -0,0 +1,168 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <CoFSM.h>
+
+using CoFSM::FSM;
+using CoFSM::Event;
+using std::cout;
+using namespace std::chrono_literals;
+
+// A pool of threads which computes checksums. The jobs wait until the pool is opened,
+// so that events can be sent while every replica awaits its job.
+class Pool
+{
+public:
+    std::atomic<int> running = 0, maxRunning = 0;  // Jobs running at the same time
+
+    explicit Pool(unsigned numThreads)
+    {
+        for (unsigned i = 0; i < numThreads; ++i)
+            _threads.emplace_back([this](std::stop_token stop) { work(stop); });
+    }
+
+    ~Pool()
+    {
+        for (auto& thread : _threads)
+            thread.request_stop();
+        _cv.notify_all();
+    }
+
+    void open()
+    {
+        _bOpen = true;
+        _bOpen.notify_all();
+    }
+
+    // Awaitable which computes the checksum of the number in a thread of the pool
+    // and resumes the state there.
+    struct Checksum
+    {
+        Pool* pool;
+        unsigned value;
+        unsigned result = 0;
+
+        bool await_ready() { return false; }
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            pool->post([this, h] {
+                pool->_bOpen.wait(false);
+                const int now = ++pool->running;
+                int max = pool->maxRunning;
+                while (now > max && !pool->maxRunning.compare_exchange_weak(max, now))
+                    ;
+                std::this_thread::sleep_for(10ms);
+                --pool->running;
+                result = value * 2654435761u;
+                h.resume();
+            });
+        }
+        unsigned await_resume() { return result; }
+    };
+
+    Checksum checksum(unsigned value) { return Checksum{this, value}; }
+
+private:
+    void post(std::function<void()> job)
+    {
+        std::lock_guard lock(_mutex);
+        _jobs.push_back(std::move(job));
+        _cv.notify_one();
+    }
+
+    void work(std::stop_token stop)
+    {
+        while (true) {
+            std::function<void()> job;
+            {
+                std::unique_lock lock(_mutex);
+                _cv.wait(lock, [&] { return stop.stop_requested() || !_jobs.empty(); });
+                if (_jobs.empty())
+                    return;
+                job = std::move(_jobs.front());
+                _jobs.pop_front();
+            }
+            job();
+        }
+    }
+
+    std::atomic<bool> _bOpen = false;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque<std::function<void()>> _jobs;
+    std::vector<std::jthread> _threads;
+};
+
+// What the replicas computed. The replicas run one at a time after their jobs,
+// so the results need no lock.
+struct Results
+{
+    unsigned sum = 0;
+    int count = 0;
+    std::vector<int> eventsPerReplica;
+};
+
+// A replica of the checksum stage. Hands the work to the pool and keeps the result.
+CoFSM::State stateChecksum(FSM& fsm, std::size_t replica, Pool* pPool, Results* pResults)
+{
+    Event event = co_await fsm.getEvent();
+    while (true) {
+        unsigned* pValue;
+        event >> pValue;
+        const unsigned checksum = co_await fsm.awaitExternal(pPool->checksum(*pValue));
+        pResults->sum += checksum;
+        ++pResults->count;
+        ++pResults->eventsPerReplica[replica];
+        event.destroy();
+        event = co_await fsm.emitAndReceive(&event);
+    }
+}
+
+static bool check(bool bOk, const char* what)
+{
+    cout << (bOk ? "OK:   " : "FAIL: ") << what << '\n';
+    return bOk;
+}
+
+int main()
+{
+    constexpr std::size_t numReplicas = 4;
+    Pool pool(numReplicas);
+    Results results;
+    results.eventsPerReplica.resize(numReplicas);
+    FSM fsm("Stage");
+    fsm << CoFSM::State(numReplicas, [&](std::size_t i) { return stateChecksum(fsm, i, &pool, &results); }, "checksumState");
+    fsm.start().setState("checksumState");
+    const CoFSM::State& state = fsm.getStateAt(0);
+    bool bOk = check(state.isReplicated() && state.numberOfReplicas() == numReplicas && !state.handle(),
+                     "the state has four replicas and no handle of its own");
+
+    // 1. Each of the first four events goes to a replica of its own, which awaits its job
+    //    while this thread goes on. The next events wait until a replica is free.
+    Event event;
+    unsigned expected = 0;
+    for (unsigned value = 1; value <= 6; ++value) {
+        event.construct("DataEvent", value);
+        fsm.sendEvent(&event);
+        expected += value * 2654435761u;
+        if (value == numReplicas)
+            bOk &= check(fsm.isBusy() && fsm.numberOfBufferedEvents() == 0, "every replica is out and no event waits");
+    }
+    bOk &= check(fsm.numberOfBufferedEvents() == 2, "the events wait while every replica is out");
+
+    // 2. The replicas await their jobs in parallel and rejoin the FSM one at a time.
+    pool.open();
+    for (int i = 0; i < 1000 && (fsm.isBusy() || fsm.isActive()); ++i)
+        std::this_thread::sleep_for(1ms);
+    bOk &= check(!fsm.isBusy() && results.count == 6 && results.sum == expected, "every event was handled");
+    bOk &= check(pool.maxRunning > 1, "the jobs of the replicas ran in parallel");
+    bOk &= check(std::ranges::all_of(results.eventsPerReplica, [](int n) { return n > 0; }),
+                 "every replica got an event");
+    return bOk ? 0 : 1;
+}
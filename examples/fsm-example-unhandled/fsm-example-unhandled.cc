@@ -0,0 +1,89 @@
+#include <iostream>
+#include <CoFSM.h>
+
+using CoFSM::FSM;
+using CoFSM::Event;
+using std::cout;
+
+// Sums the numbers it receives and rejects every other event without throwing.
+CoFSM::State stateAdder(FSM& fsm, int* pSum)
+{
+    Event event = co_await fsm.getEvent();
+    while (true) {
+        if (int* pValue; event == "NumberEvent") {
+            event >> pValue;
+            *pSum += *pValue;
+            event.destroy(); // Suspend the FSM until the next number comes.
+            event = co_await fsm.emitAndReceive(&event);
+        }
+        else // Garbage. Let the FSM deal with it according to its policy.
+            event = co_await fsm.rejectAndReceive(&event);
+    }
+}
+
+// Receives the events which the adder rejected. Repairs the events which it understands
+// and rejects the rest, which then end up in the dead-letter queue.
+CoFSM::State stateRepair(FSM& fsm)
+{
+    Event event = co_await fsm.getEvent();
+    while (true) {
+        if (std::string* pText; event == "TextEvent") {
+            event >> pText;
+            event.construct("NumberEvent", int(pText->size()));
+            event = co_await fsm.emitAndReceive(&event);
+        }
+        else
+            event = co_await fsm.rejectAndReceive(&event);
+    }
+}
+
+static bool check(bool bOk, const char* what)
+{
+    cout << (bOk ? "OK:   " : "FAIL: ") << what << '\n';
+    return bOk;
+}
+
+int main()
+{
+    using namespace CoFSM;
+    int sum = 0;
+    FSM fsm("Adder");
+    fsm << (stateAdder(fsm, &sum) = "adderState")
+        << (stateRepair(fsm) = "repairState")
+        << transition("repairState", "NumberEvent", "adderState");
+    fsm.start();
+
+    // 1. Dead letters: the garbage is kept for inspection.
+    fsm.setUnhandledPolicy(FSM::Unhandled::DeadLetter).setState("adderState");
+    Event event;
+    for (int i = 1; i <= 10; ++i) {
+        if (i % 3 == 0)
+            event.construct("GarbageEvent", i);
+        else
+            event.construct("NumberEvent", i);
+        fsm.sendEvent(&event);
+    }
+    bool bOk = check(sum == 1 + 2 + 4 + 5 + 7 + 8 + 10, "the numbers were summed");
+    bOk &= check(fsm.unhandledCount() == 3, "three events were rejected");
+    bOk &= check(fsm.deadLetters().size() == 3 && fsm.deadLetters().front() == "GarbageEvent", "the rejected events are in the dead-letter queue");
+    bOk &= check(fsm.takeDeadLetters().size() == 3 && fsm.deadLetters().empty(), "takeDeadLetters() empties the queue");
+
+    // 2. Error state: the rejected text is repaired and routed back to the adder,
+    //    while the garbage which the error state rejects, too, becomes a dead letter.
+    fsm.setErrorState("repairState");
+    sum = 0;
+    event.construct("TextEvent", std::string("abcd"));
+    fsm.sendEvent(&event);
+    bOk &= check(sum == 4 && fsm.currentState() == "adderState", "the error state repaired the event");
+    event.construct("GarbageEvent", 0);
+    fsm.sendEvent(&event);
+    bOk &= check(fsm.deadLetters().size() == 1 && fsm.unhandledCount() == 6, "the event rejected by the error state is a dead letter");
+
+    // 3. Count: the rejected events are only counted.
+    fsm.setUnhandledPolicy(FSM::Unhandled::Count).setState("adderState");
+    event.construct("GarbageEvent", 0);
+    fsm.sendEvent(&event);
+    bOk &= check(fsm.unhandledCount() == 7 && fsm.deadLetters().size() == 1 && !fsm.isActive(), "the rejected event was counted and discarded");
+
+    return bOk ? 0 : 1;
+}
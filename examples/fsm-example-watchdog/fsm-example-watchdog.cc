@@ -0,0 +1,110 @@
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <CoFSM.h>
+
+using CoFSM::FSM;
+using CoFSM::Event;
+using std::cout;
+using namespace std::chrono_literals;
+
+// Work is a pair of milliseconds: how long it takes to fetch and how long to store.
+using Work = std::pair<int, int>;
+
+// Blocks for the time it takes to fetch, which a real state would spend in a blocking call.
+// Waits for the next work when the store is done.
+CoFSM::State stateFetch(FSM& fsm)
+{
+    Event event = co_await fsm.getEvent();
+    while (true) {
+        if (Work* pWork; event == "WorkEvent") {
+            event >> pWork;
+            std::this_thread::sleep_for(std::chrono::milliseconds(pWork->first));
+            event.construct("FetchedEvent", *pWork);
+            event = co_await fsm.emitAndReceive(&event);
+        }
+        else if (event == "StoredEvent") {
+            event.destroy(); // Suspend the FSM until the next work comes.
+            event = co_await fsm.emitAndReceive(&event);
+        }
+        else
+            event = co_await fsm.rejectAndReceive(&event);
+    }
+}
+
+// Blocks for the time it takes to store.
+CoFSM::State stateStore(FSM& fsm)
+{
+    Event event = co_await fsm.getEvent();
+    while (true) {
+        if (Work* pWork; event == "FetchedEvent") {
+            event >> pWork;
+            std::this_thread::sleep_for(std::chrono::milliseconds(pWork->second));
+            event.construct("StoredEvent");
+            event = co_await fsm.emitAndReceive(&event);
+        }
+        else
+            event = co_await fsm.rejectAndReceive(&event);
+    }
+}
+
+static bool check(bool bOk, const char* what)
+{
+    cout << (bOk ? "OK:   " : "FAIL: ") << what << '\n';
+    return bOk;
+}
+
+int main()
+{
+    using namespace CoFSM;
+    FSM fsm("Worker");
+    fsm << (stateFetch(fsm) = "fetchState")
+        << (stateStore(fsm) = "storeState")
+        << transition("fetchState", "FetchedEvent", "storeState")
+        << transition("storeState", "StoredEvent", "fetchState");
+    fsm.start().setState("fetchState");
+
+    // The callback is called from the thread of the watchdog.
+    std::mutex mutex;
+    std::vector<std::pair<std::string, std::string>> reports;
+    Watchdog watchdog([&](const std::string& fsmName, const std::string& stateName, std::chrono::milliseconds elapsed) {
+        cout << "FSM '" << fsmName << "' is stuck in state '" << stateName << "' for " << elapsed.count() << " ms\n";
+        std::lock_guard lock(mutex);
+        reports.emplace_back(fsmName, stateName);
+    }, 10ms);
+    watchdog.watch(fsm, 100ms);                  // Every state must make progress within 100 ms...
+    watchdog.setDeadline(fsm, "storeState", 400ms); // ...except storeState, which may take 400 ms.
+
+    auto numReports = [&] { std::lock_guard lock(mutex); return reports.size(); };
+    Event event;
+
+    // 1. Both states are fast.
+    event.construct("WorkEvent", Work{20, 20});
+    fsm.sendEvent(&event);
+    bool bOk = check(numReports() == 0, "a fast FSM is not reported");
+
+    // 2. The store takes longer than the default deadline but not longer than its own deadline.
+    event.construct("WorkEvent", Work{20, 250});
+    fsm.sendEvent(&event);
+    bOk &= check(numReports() == 0, "a state within its own deadline is not reported");
+
+    // 3. The fetch stalls past the default deadline. It is reported once although it stays stuck
+    //    for several scans.
+    event.construct("WorkEvent", Work{400, 20});
+    fsm.sendEvent(&event);
+    {
+        std::lock_guard lock(mutex);
+        bOk &= check(reports.size() == 1 && reports[0] == std::pair<std::string, std::string>{"Worker", "fetchState"},
+                     "the stalled state was reported once");
+    }
+
+    // 4. An FSM which waits for an event is idle, not stuck.
+    std::this_thread::sleep_for(200ms);
+    bOk &= check(numReports() == 1, "an idle FSM is not reported");
+    bOk &= check(fsm.transitionCount() == 9, "every transition was counted");
+
+    watchdog.unwatch(fsm); // Must be done before the FSM is destroyed.
+    return bOk ? 0 : 1;
+}
@@ -14,10 +14,24 @@
 #include <array>
 #include <concepts>
 #include <unordered_map>
+#include <unordered_set>
+#include <optional>
+#include <exception>
 #include <initializer_list>
 #include <assert.h>
 #include <atomic>
 #include <any>
+#include <deque>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <tuple>
+#include <cstdint>
+#include <cmath>
+#include <memory_resource>
+#include <stop_token>
 
 namespace CoFSM {
 
@@ -33,6 +47,129 @@ static const std::string _sharedEmptyString{};
 template <class T>
 concept Trivial = (std::is_trivially_destructible_v<T> || std::is_same_v<T, void>);
 
+// Kinds of memory tracked by MemoryAccount.
+enum class MemoryCategory { Frames, Table, States, Names, Events };
+
+// Snapshot of the bytes charged to a MemoryAccount.
+struct MemoryUsage
+{
+    std::size_t frames = 0;  // Coroutine frames of the states and bodies of callable states
+    std::size_t table = 0;   // Nodes and buckets of the transition table
+    std::size_t states = 0;  // The vector of states
+    std::size_t names = 0;   // Heap allocated state names
+    std::size_t events = 0;  // Data buffers of the events attached to the account
+    std::size_t total() const { return frames + table + states + names + events; }
+};
+
+// Keeps count of the memory used by an FSM or a group of FSMs which share the account.
+// If an allocation would exceed the quota, onQuotaExceeded is called. If it returns true,
+// the allocation is let through. Otherwise (or if there is no callback) the allocation fails
+// and std::runtime_error is thrown. For a state coroutine, the exception comes from the call
+// of the coroutine function, which allocates the frame.
+class MemoryAccount
+{
+public:
+    static constexpr std::size_t noQuota = std::size_t(-1);
+
+    explicit MemoryAccount(std::size_t quota = noQuota) : _quota(quota) {}
+    MemoryAccount(const MemoryAccount&) = delete;
+    MemoryAccount& operator=(const MemoryAccount&) = delete;
+
+    // Charges the bytes to the account. Returns false if the quota does not allow it.
+    bool charge(MemoryCategory category, std::size_t bytes) noexcept
+    {
+        const std::size_t newTotal = _total.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+        if (newTotal > _quota.load(std::memory_order_relaxed)) {
+            bool bAllow = false;
+            try {
+                bAllow = onQuotaExceeded && onQuotaExceeded(category, bytes);
+            } catch (...) {}
+            if (!bAllow) {
+                _total.fetch_sub(bytes, std::memory_order_relaxed);
+                return false;
+            }
+        }
+        _bytes[std::size_t(category)].fetch_add(bytes, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Returns the bytes to the account.
+    void release(MemoryCategory category, std::size_t bytes) noexcept
+    {
+        _bytes[std::size_t(category)].fetch_sub(bytes, std::memory_order_relaxed);
+        _total.fetch_sub(bytes, std::memory_order_relaxed);
+    }
+
+    // Returns the current numbers.
+    MemoryUsage usage() const
+    {
+        auto get = [this](MemoryCategory c) { return _bytes[std::size_t(c)].load(std::memory_order_relaxed); };
+        return MemoryUsage{get(MemoryCategory::Frames), get(MemoryCategory::Table), get(MemoryCategory::States),
+                           get(MemoryCategory::Names), get(MemoryCategory::Events)};
+    }
+
+    // Returns the total number of bytes charged to the account.
+    std::size_t total() const { return _total.load(std::memory_order_relaxed); }
+
+    std::size_t quota() const { return _quota.load(std::memory_order_relaxed); }
+    void setQuota(std::size_t quota) { _quota.store(quota, std::memory_order_relaxed); }
+
+    // Called with the category and the size of an allocation which would exceed the quota.
+    // Must be set before the account is used by several threads.
+    std::function<bool(MemoryCategory category, std::size_t bytes)> onQuotaExceeded;
+
+private:
+    std::array<std::atomic<std::size_t>, 5> _bytes{};
+    std::atomic<std::size_t> _total = 0;
+    std::atomic<std::size_t> _quota;
+}; // MemoryAccount
+
+// Standard allocator which charges the allocations to a MemoryAccount.
+template <class T>
+struct AccountingAllocator
+{
+    using value_type = T;
+
+    AccountingAllocator(MemoryAccount* a, MemoryCategory c) noexcept : account(a), category(c) {}
+    template <class U>
+    AccountingAllocator(const AccountingAllocator<U>& other) noexcept : account(other.account), category(other.category) {}
+
+    T* allocate(std::size_t n)
+    {
+        if (account && !account->charge(category, n * sizeof(T)))
+            throw std::runtime_error("CoFSM: memory quota exceeded.");
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept
+    {
+        std::allocator<T>().deallocate(p, n);
+        if (account)
+            account->release(category, n * sizeof(T));
+    }
+
+    template <class U>
+    bool operator==(const AccountingAllocator<U>& other) const noexcept { return account == other.account; }
+
+    MemoryAccount* account;
+    MemoryCategory category;
+};
+
+class FSM;
+
+// Optional fixed-size header of an event for tracing and latency accounting.
+// It lives apart from the data buffer, so constructing a new payload into the event
+// keeps the header and never reallocates the buffer because of it. The header moves
+// with the event, also in cross-FSM transitions.
+struct EventMeta
+{
+    std::chrono::steady_clock::time_point enqueued{};  // Set by Inbox::submit() and FairScheduler::post()
+    std::array<std::uint64_t, 2> traceId{};             // 128-bit trace id, {high, low}
+    std::uint64_t sequence = 0;
+    const FSM* sourceFsm = nullptr;                     // The FSM of the state which emitted the event most recently
+    std::size_t sourceState = std::size_t(-1);          // Index of that state in sourceFsm
+};
+
 // Generic reusable Event class.
 // An object of this type hold its identity in a string_view
 // and data in a byte buffer. Hence an event object can be reused
@@ -48,6 +185,8 @@ struct Event {
         _capacity = std::exchange(other._capacity, 0u);
         _data = std::exchange(other._data, nullptr);
         _anyPtr = std::exchange(other._anyPtr, nullptr);
+        _account = std::exchange(other._account, nullptr);
+        _meta = std::move(other._meta);
     }
 
     Event& operator=(Event&& other) noexcept
@@ -58,6 +197,8 @@ struct Event {
             _capacity = std::exchange(other._capacity, 0u);
             _data = std::exchange(other._data, nullptr);
             _anyPtr = std::exchange(other._anyPtr, nullptr);
+            _account = std::exchange(other._account, nullptr);
+            _meta = std::move(other._meta);
         }
         return *this;
     }
@@ -68,6 +209,8 @@ struct Event {
         // the object living in the buffer will be destroyed at the destructor of AnyPtr<T>
         _anyPtr.reset();
         delete [] _data;
+        if (_account)
+            _account->release(MemoryCategory::Events, _capacity);
     }
 
     // Constructs a new object of type T into the data block using placement new.
@@ -164,6 +307,8 @@ struct Event {
 
         _anyPtr.reset(); // Destroy the object in the buffer, if any.
         _name = "";
+        if (_account)
+            _account->release(MemoryCategory::Events, _capacity);
         _capacity = 0;
         delete [] _data;
         _data = nullptr;
@@ -173,14 +318,26 @@ struct Event {
     void reserve(std::size_t size)
     {
         if (_capacity < size) {
-            if (!_anyPtr)  // Make a new empty AnyPtr object
-                _anyPtr = std::make_unique_for_overwrite<std::any>();
-            else if (_anyPtr->has_value())
+            if (_account && !_account->charge(MemoryCategory::Events, size))
+                throw std::runtime_error("CoFSM::Event: memory quota exceeded when reserving " + std::to_string(size) + " bytes.");
+            std::byte* pData;
+            try {
+                if (!_anyPtr)  // Make a new empty AnyPtr object
+                    _anyPtr = std::make_unique_for_overwrite<std::any>();
+                pData = new std::byte[size];
+            } catch (...) {
+                if (_account)
+                    _account->release(MemoryCategory::Events, size);
+                throw;
+            }
+            if (_account)
+                _account->release(MemoryCategory::Events, _capacity);
+            if (_anyPtr->has_value())
                 *_anyPtr = std::any{};   // Destroy the object in the buffer, if any.
             _name = "";
             _capacity = size;
             delete [] _data;
-            _data = new std::byte[size];
+            _data = pData;
         }
     }
 
@@ -188,6 +345,34 @@ struct Event {
     // in the data buffer without reallocation.
     std::size_t capacity() const { return _capacity; }
 
+    // Charges the data buffer of the event to the given account from now on.
+    // The buffer is moved away from the previous account, if any.
+    // The account follows the buffer when the event is moved.
+    void setMemoryAccount(MemoryAccount* account)
+    {
+        if (account && !account->charge(MemoryCategory::Events, _capacity))
+            throw std::runtime_error("CoFSM::Event: memory quota exceeded when changing the account.");
+        if (_account)
+            _account->release(MemoryCategory::Events, _capacity);
+        _account = account;
+    }
+
+    // Returns the account to which the data buffer is charged or nullptr.
+    MemoryAccount* memoryAccount() const { return _account; }
+
+    // Gives the event a metadata header, if it does not have one yet, and returns it.
+    // The header is kept by construct(), destroy() and clear() and it moves with the event.
+    EventMeta& enableMeta()
+    {
+        if (!_meta)
+            _meta = std::make_unique<EventMeta>();
+        return *_meta;
+    }
+
+    // Returns the metadata header or nullptr if the event does not have one.
+    EventMeta* meta() { return _meta.get(); }
+    const EventMeta* meta() const { return _meta.get(); }
+
     // Returns true if the name of the event == other
     bool isEqual(const std::string_view& other) const { return (_name.compare(other) == 0); }
 
@@ -257,6 +442,10 @@ private:
     // An std::any object which contains an object of type AnyPtr<T> where T is the type
     // of the object living in the buffer. T = void if there is no object in the buffer.
     std::unique_ptr<std::any> _anyPtr;
+    // Account to which the data buffer is charged, if any.
+    MemoryAccount* _account = nullptr;
+    // Optional metadata header.
+    std::unique_ptr<EventMeta> _meta;
 }; // Event
 
 // Returns true if the name of the event is sv.
@@ -283,6 +472,18 @@ inline std::string asHex(std::coroutine_handle<> h)
     return asHex(h.address());
 }
 
+// Hashes strings and string_views alike so that a map keyed by std::string
+// can be searched with a string_view without making a string.
+struct NameHash
+{
+    using is_transparent = void;
+    std::size_t operator() (std::string_view sv) const noexcept { return std::hash<std::string_view>()(sv); }
+};
+
+class FSMGroup;
+class FairScheduler;
+class AffinityRunner;
+
 // Return type of coroutines which represent states.
 struct State
 {
@@ -304,6 +505,34 @@ struct State
             void* addr = std::coroutine_handle<promise_type>::from_promise(*this).address();
             name = asHex(addr);
         }
+
+        // Every frame is preceded by a header which keeps the account the frame has been
+        // charged to alive until the frame is freed. The operators are always inlined so that
+        // gcc sees ::operator new and ::operator delete as a pair and does not warn about
+        // mismatched allocation functions.
+
+        // Used if the FSM is the first argument of the state coroutine. The frame, including
+        // its header, is charged to the memory account of the FSM. Throws if the quota of the
+        // account does not allow it. A frame which the compiler has elided is not charged.
+        template <class... Args>
+        [[gnu::always_inline]] static void* operator new(std::size_t size, FSM& fsm, const Args&...);
+
+        // Used for the other state coroutines, whose frames are not charged.
+        [[gnu::always_inline]] static void* operator new(std::size_t size)
+        {
+            return allocateFrame(size, nullptr);
+        }
+
+        // Returns the frame to the account it was charged to, if any.
+        [[gnu::always_inline]] static void operator delete(void* pFrame, std::size_t size) noexcept
+        {
+            FrameHeader* pHeader = headerOf(pFrame);
+            if (pHeader->account)
+                pHeader->account->release(MemoryCategory::Frames, size + headerSize);
+            pHeader->~FrameHeader();
+            ::operator delete(pHeader, size + headerSize);
+        }
+
         InitialAwaitable initial_suspend() noexcept { return InitialAwaitable{this}; }
         constexpr std::suspend_always final_suspend() noexcept { return {}; }
         State get_return_object() noexcept { return State(this); };
@@ -319,21 +548,98 @@ struct State
         // true if the state has been resumed from the initial_suspend.
 
         bool bIsStarted = false;
+
+        // Index of the state in the FSM to which it has been added.
+        std::size_t index = std::size_t(-1);
+
+        // Bytes of the name charged to the memory account of the FSM.
+        std::size_t nameBytes = 0;
+
+    private:
+        struct FrameHeader
+        {
+            std::shared_ptr<MemoryAccount> account;  // Null if the frame has not been charged
+        };
+
+        // The header takes a multiple of the default alignment so that the frame stays aligned.
+        static constexpr std::size_t headerSize =
+            (sizeof(FrameHeader) + __STDCPP_DEFAULT_NEW_ALIGNMENT__ - 1) / __STDCPP_DEFAULT_NEW_ALIGNMENT__ * __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+
+        static FrameHeader* headerOf(void* pFrame)
+        {
+            return reinterpret_cast<FrameHeader*>(static_cast<std::byte*>(pFrame) - headerSize);
+        }
+
+        // Allocates a frame whose header refers to the account, which has already been charged.
+        static void* allocateFrame(std::size_t size, std::shared_ptr<MemoryAccount> account)
+        {
+            std::byte* p = static_cast<std::byte*>(::operator new(size + headerSize));
+            ::new (p) FrameHeader{std::move(account)};
+            return p + headerSize;
+        }
     }; // promise_type
 
     using handle_type = std::coroutine_handle<promise_type>;
 
-    // Returns the handle to the state coroutine.
+    // Signature of a callable state. It receives the event and leaves the event
+    // it emits in the same object. An empty event stops the FSM.
+    using Body = std::function<void(Event&)>;
+
+    // Makes a callable state which has no coroutine frame. The FSM calls the body inline
+    // when it routes an event to the state and routes the emitted event on right away.
+    // Suits states which keep no locals from one event to the next.
+    explicit State(Body body, std::string stateName = {}) : callable_(std::make_unique<Callable>())
+    {
+        if (!body)
+            throw std::runtime_error("Attempt to make a callable state without a body.");
+        callable_->body = std::move(body);
+        callable_->name = stateName.empty() ? asHex(callable_.get()) : std::move(stateName);
+    }
+
+    // Makes a replicated state of numReplicas coroutines returned by makeReplica(i), e.g.
+    // "State(4, [&](std::size_t) { return checksum(fsm); }, "Checksum")".
+    // The replicas share the name, the index and the transitions of the state. The FSM routes
+    // an event to a replica which is not awaiting an external operation, so while some replicas
+    // await FSM::awaitExternal(), the others handle the next events.
+    template <class F>
+    requires std::invocable<F&, std::size_t>
+    State(std::size_t numReplicas, F&& makeReplica, std::string stateName = {}) : replicas_(std::make_unique<Replicas>())
+    {
+        if (numReplicas == 0)
+            throw std::runtime_error("Attempt to make a replicated state without replicas.");
+        replicas_->states.reserve(numReplicas);
+        for (std::size_t i = 0; i < numReplicas; ++i) {
+            replicas_->states.push_back(makeReplica(i));
+            if (!replicas_->states.back().handle())
+                throw std::runtime_error("The replicas of a replicated state must be coroutines.");
+        }
+        replicas_->bOut.assign(numReplicas, false);
+        replicas_->name = stateName.empty() ? asHex(replicas_.get()) : std::move(stateName);
+    }
+
+    // Returns the handle to the state coroutine. Null if the state is callable.
     handle_type handle() const noexcept { return coro_handle_; }
 
     // State has one-to-one correspondence to its coroutine handle
     operator handle_type() const noexcept { return coro_handle_; }
 
+    // True if the state is a callable instead of a coroutine.
+    bool isCallable() const noexcept { return bool(callable_); }
+
+    // True if the state has replicas instead of one coroutine.
+    bool isReplicated() const noexcept { return bool(replicas_); }
+
+    // Returns the number of replicas of a replicated state and 1 otherwise.
+    std::size_t numberOfReplicas() const noexcept { return replicas_ ? replicas_->states.size() : 1; }
+
+    // False if the state has been moved from or removed from its FSM.
+    bool isValid() const noexcept { return coro_handle_ || callable_ || replicas_; }
+
     // Sets human-readable name for the state.
     State&& setName(std::string stateName)
     {
         if (!stateName.empty())
-            coro_handle_.promise().name = std::move(stateName);
+            (callable_ ? callable_->name : replicas_ ? replicas_->name : coro_handle_.promise().name) = std::move(stateName);
         return std::move(*this);
     }
 
@@ -343,25 +649,36 @@ struct State
         return std::move(setName(std::move(stateName)));
     }
 
-    // Returns the name of the state coroutine.
+    // Returns the name of the state coroutine. Empty if the state is not valid.
     const std::string& getName() const
     {
-        return coro_handle_.promise().name;
+        if (callable_)
+            return callable_->name;
+        if (replicas_)
+            return replicas_->name;
+        return coro_handle_ ? coro_handle_.promise().name : _sharedEmptyString;
     }
 
     // False if the state is still waiting in initial_suspend.
     // True if the initial await has been resumed /typically by calling CoFSM::start())
+    // A state without a coroutine is always started. A replicated state is started
+    // when all of its replicas are.
     bool isStarted() const
     {
-        return coro_handle_.promise().bIsStarted;
+        if (replicas_)
+            return std::all_of(replicas_->states.begin(), replicas_->states.end(), [](const State& r) { return r.isStarted(); });
+        return !coro_handle_ || coro_handle_.promise().bIsStarted;
     }
 
     // Move constructors.
-    State(State&& other) noexcept : coro_handle_(std::exchange(other.coro_handle_, nullptr)) {}
+    State(State&& other) noexcept
+        : coro_handle_(std::exchange(other.coro_handle_, nullptr)), callable_(std::move(other.callable_)), replicas_(std::move(other.replicas_)) {}
 
     State& operator=(State&& other) noexcept
     {
         coro_handle_ = std::exchange(other.coro_handle_, nullptr);
+        callable_ = std::move(other.callable_);
+        replicas_ = std::move(other.replicas_);
         return *this;
     }
 
@@ -370,20 +687,268 @@ struct State
             coro_handle_.destroy();
     }
 private:
+    friend class FSM;
+
     // A state is move-only
     State(const State&) = delete;
     State& operator=(const State&) = delete;
 
     explicit State(promise_type *p) noexcept : coro_handle_(handle_type::from_promise(*p)) {}
 
+    // Body and bookkeeping of a callable state.
+    struct Callable
+    {
+        Body body;
+        std::string name;
+        std::size_t index = std::size_t(-1);  // Index of the state in its FSM
+        std::shared_ptr<MemoryAccount> account;  // The account to which the object has been charged, if any
+        std::size_t nameBytes = 0;            // Bytes of the name charged to the account of the FSM
+
+        ~Callable()
+        {
+            if (account)
+                account->release(MemoryCategory::Frames, sizeof(Callable));
+        }
+    };
+
+    // Coroutines of a replicated state. Only the thread which runs the FSM touches them.
+    struct Replicas
+    {
+        std::vector<State> states;
+        std::vector<bool> bOut;  // True while the replica awaits an external operation
+        std::size_t numOut = 0;
+        std::size_t next = 0;    // The replica to try first
+        std::string name;
+        std::size_t nameBytes = 0;  // Bytes of the name charged to the account of the FSM
+    };
+
+    // Index of the state in the FSM to which it has been added.
+    // The replicas of a replicated state have the index of the state.
+    std::size_t index() const
+    {
+        if (replicas_)
+            return replicas_->states.front().index();
+        return callable_ ? callable_->index : coro_handle_.promise().index;
+    }
+    void setIndex(std::size_t i)
+    {
+        if (replicas_) {
+            for (State& replica : replicas_->states)
+                replica.setIndex(i);
+            return;
+        }
+        (callable_ ? callable_->index : coro_handle_.promise().index) = i;
+    }
+
+    // Bytes of the name charged to the memory account of the FSM when the state was added.
+    std::size_t& chargedNameBytes()
+    {
+        return callable_ ? callable_->nameBytes : replicas_ ? replicas_->nameBytes : coro_handle_.promise().nameBytes;
+    }
+    std::size_t chargedNameBytes() const { return const_cast<State*>(this)->chargedNameBytes(); }
+
     handle_type coro_handle_;
+    std::unique_ptr<Callable> callable_;
+    std::unique_ptr<Replicas> replicas_;
 }; // State
 
 // A state can be presented either as a name string or as a coroutine handle.
 template<class T>
 concept StateType = std::convertible_to<T, std::string_view> || std::convertible_to<T, typename State::handle_type>;
 
-class FSM;
+// Bounded single-producer single-consumer queue which lets the results of an FSM
+// leave it without suspending the FSM. The producer is a state of the FSM which calls
+// emitOut() and the consumer is typically another thread which calls drain().
+// If a callback has been set, emitOut() calls it directly instead of queueing.
+template <class T>
+requires std::movable<T> && std::default_initializable<T>
+class OutputPort
+{
+public:
+    // The capacity is rounded up to the next power of two.
+    explicit OutputPort(std::size_t capacity)
+    {
+        std::size_t n = 1;
+        while (n < capacity)
+            n *= 2;
+        _buffer.resize(n);
+        _mask = n - 1;
+    }
+
+    OutputPort(const OutputPort&) = delete;
+    OutputPort& operator=(const OutputPort&) = delete;
+
+    // Passes the value to the consumer. Never blocks.
+    // Returns false if the queue is full and the value was dropped.
+    template <class U>
+    requires std::constructible_from<T, U&&>
+    bool emitOut(U&& value)
+    {
+        if (_callback) {
+            _callback(T(std::forward<U>(value)));
+            return true;
+        }
+        const std::size_t head = _head.load(std::memory_order_relaxed);
+        if (head - _tailCache > _mask) { // Looks full. Check where the consumer is.
+            _tailCache = _tail.load(std::memory_order_acquire);
+            if (head - _tailCache > _mask) {
+                _dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+        }
+        _buffer[head & _mask] = T(std::forward<U>(value));
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Calls consumer(T&&) for at most maxItems values in the order they were emitted.
+    // Returns the number of values consumed.
+    template <class F>
+    requires std::invocable<F&, T&&>
+    std::size_t drain(F&& consumer, std::size_t maxItems = std::size_t(-1))
+    {
+        const std::size_t tail = _tail.load(std::memory_order_relaxed);
+        const std::size_t head = _head.load(std::memory_order_acquire);
+        const std::size_t n = std::min(head - tail, maxItems);
+        for (std::size_t i = 0; i < n; ++i)
+            consumer(std::move(_buffer[(tail + i) & _mask]));
+        _tail.store(tail + n, std::memory_order_release);
+        return n;
+    }
+
+    // Makes emitOut() call the callback instead of queueing the value.
+    // An empty callback restores queueing. Must not be changed while the FSM is active.
+    void setCallback(std::function<void(T&&)> callback) { _callback = std::move(callback); }
+
+    // Returns the number of values waiting to be drained.
+    std::size_t size() const { return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire); }
+
+    // Returns the maximum number of values the queue can hold.
+    std::size_t capacity() const { return _mask + 1; }
+
+    // Returns the number of values dropped because the queue was full.
+    std::size_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+
+private:
+    std::vector<T> _buffer;
+    std::size_t _mask = 0;
+    std::function<void(T&&)> _callback;
+    // Producer's side: the next slot to be written and the latest known read position.
+    alignas(hardware_constructive_interference_size) std::atomic<std::size_t> _head = 0;
+    std::size_t _tailCache = 0;
+    std::atomic<std::size_t> _dropped = 0;  // Written by the producer and read by anyone
+    // Consumer's side: the next slot to be read.
+    alignas(hardware_constructive_interference_size) std::atomic<std::size_t> _tail = 0;
+}; // OutputPort
+
+// Bump-pointer memory resource for the temporary allocations a state makes while it
+// handles an event. Deallocation does nothing. Everything is released at once by reset(),
+// which the FSM calls when a state emits its event. If the current block runs out, a bigger
+// one is taken from the upstream resource. At reset the blocks are replaced with a single
+// block which is large enough for all of them, so a steady workload stops touching the heap.
+class ScratchArena : public std::pmr::memory_resource
+{
+public:
+    explicit ScratchArena(std::size_t initialSize = 4096, std::pmr::memory_resource* upstream = std::pmr::new_delete_resource())
+        : _nextSize(std::max<std::size_t>(initialSize, 2 * sizeof(Block))), _upstream(upstream) {}
+    ScratchArena(const ScratchArena&) = delete;
+    ScratchArena& operator=(const ScratchArena&) = delete;
+    ~ScratchArena() { releaseBlocks(); }
+
+    // Makes all the memory available again. The objects allocated from the arena
+    // must have been destroyed already.
+    void reset() noexcept
+    {
+        if (!_pBlock)
+            return;
+        if (_pBlock->pNext) {  // Merge the blocks into one.
+            const std::size_t size = capacity() + sizeof(Block);
+            releaseBlocks();
+            try {
+                addBlock(size);
+            } catch (...) {
+                return;  // Try again when memory is needed.
+            }
+        }
+        _current = begin(_pBlock);
+        _usedInFullBlocks = 0;
+    }
+
+    // Returns the number of bytes allocated since the latest reset, including alignment.
+    std::size_t used() const { return _pBlock ? _usedInFullBlocks + (_current - begin(_pBlock)) : 0; }
+
+    // Returns the greatest number of bytes which have been in use at the same time.
+    std::size_t highWaterMark() const { return _highWaterMark; }
+
+    // Returns the number of bytes the arena can hand out without going upstream.
+    std::size_t capacity() const
+    {
+        std::size_t bytes = 0;
+        for (const Block* p = _pBlock; p; p = p->pNext)
+            bytes += p->size - sizeof(Block);
+        return bytes;
+    }
+
+private:
+    // Header at the beginning of each block taken from upstream.
+    struct alignas(std::max_align_t) Block
+    {
+        Block* pNext;
+        std::size_t size; // Including the header
+    };
+
+    static std::byte* begin(Block* p) { return reinterpret_cast<std::byte*>(p + 1); }
+    static std::byte* end(Block* p) { return reinterpret_cast<std::byte*>(p) + p->size; }
+
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        auto aligned = [alignment](std::byte* p) {
+            const auto a = reinterpret_cast<std::uintptr_t>(p);
+            return p + ((a + alignment - 1) / alignment * alignment - a);
+        };
+        if (!_pBlock || std::size_t(end(_pBlock) - _current) < bytes + (aligned(_current) - _current)) {
+            if (_pBlock)
+                _usedInFullBlocks += _current - begin(_pBlock);
+            addBlock(std::max(_nextSize, bytes + alignment + sizeof(Block)));
+        }
+        std::byte* p = aligned(_current);
+        _current = p + bytes;
+        _highWaterMark = std::max(_highWaterMark, used());
+        return p;
+    }
+
+    void do_deallocate(void*, std::size_t, std::size_t) override {}
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+    void addBlock(std::size_t size)
+    {
+        Block* p = static_cast<Block*>(_upstream->allocate(size, alignof(Block)));
+        p->pNext = _pBlock;
+        p->size = size;
+        _pBlock = p;
+        _current = begin(p);
+        _nextSize = 2 * size;
+    }
+
+    void releaseBlocks() noexcept
+    {
+        while (_pBlock) {
+            Block* pNext = _pBlock->pNext;
+            _upstream->deallocate(_pBlock, _pBlock->size, alignof(Block));
+            _pBlock = pNext;
+        }
+        _current = nullptr;
+        _usedInFullBlocks = 0;
+    }
+
+    Block* _pBlock = nullptr;     // The newest block, which links to the older ones
+    std::byte* _current = nullptr; // The next free byte in the newest block
+    std::size_t _usedInFullBlocks = 0;
+    std::size_t _highWaterMark = 0;
+    std::size_t _nextSize;
+    std::pmr::memory_resource* _upstream;
+}; // ScratchArena
 
 // Type for setting transition {from-state, on-event} --> {to-state of targetFSM}
 template <class FROM, class EVENT, class TO>
@@ -427,10 +992,25 @@ public:
             _name = asHex(this);
     };
 
+    // As above but the memory used by the FSM is charged to the given account,
+    // which may be shared by a group of FSMs.
+    FSM(std::string fsmName, std::shared_ptr<MemoryAccount> account) : _name(std::move(fsmName)), _memoryAccount(std::move(account))
+    {
+        if (_name.empty())
+            _name = asHex(this);
+        if (!_memoryAccount)
+            throw std::runtime_error("FSM('" + _name + "'): the memory account must not be null.");
+    };
+
     FSM()  { _name = asHex(this); };
     FSM(const FSM&) = delete;
     FSM& operator=(const FSM&) = delete;
-    ~FSM() = default;
+    ~FSM()
+    {
+        for (const State& state : _vecStates)
+            if (state.isValid())
+                _memoryAccount->release(MemoryCategory::Names, state.chargedNameBytes());
+    }
 
     // Returns the name of the FSM
     const std::string& name() const { return _name; }
@@ -439,65 +1019,70 @@ public:
     const Event& latestEvent() const { return _event; }
 
     // Returns the name of the target state of the latest transition.
-    const std::string& currentState() const { return _state ? _state.promise().name : _sharedEmptyString; }
+    const std::string& currentState() const
+    {
+        const std::size_t state = _state.load(std::memory_order_relaxed);
+        return state < _vecStates.size() ? _vecStates[state].getName() : _sharedEmptyString;
+    }
 
     // Sets the current state. The next event will come to this state.
     FSM& setState(const State& state)
     {
-        _state = state.handle();
+        const std::size_t index = lookup(state);
+        if (index == npos)
+            throw std::runtime_error("FSM('" + _name + "'): setState() was given a state which has not been added to the FSM.");
+        _state.store(index, std::memory_order_relaxed);
         return *this;
     }
 
     FSM& setState(SV stateName)
     {
-        _state = findHandle(stateName);
-        if (!_state)
+        const std::size_t index = lookup(stateName);
+        if (index == npos)
             throw std::runtime_error("FSM('" + _name + "'): setState() did not find the requested state '" + std::string(stateName) + "'");
+        _state.store(index, std::memory_order_relaxed);
         return *this;
     }
 
     // Adds transition from state 'from' to state 'to' on event 'onEvent' which lives in FSM 'targetFSM'.
+    // The states can be identified by their names, by their coroutine handles or by
+    // the State objects returned by getStateAt(). Callable states have no coroutine handle.
     // targetFSM==nullptr means this FSM, so the 4th argument can be omitted if every state
     // refers to the same FSM.
     // Returns true if {from, onEvent} pair has not been routed previously.
     // Returns false if an existing destination is replaced with '{to, targetFSM}'.
     // Typically should return true unless you deliberately modify the state machine on the fly.
-    bool addTransition(StateHandle from, SV onEvent, StateHandle to, FSM* targetFSM = nullptr)
+    template <StateType FROM, StateType TO>
+    bool addTransition(const FROM& from, SV onEvent, const TO& to, FSM* targetFSM = nullptr)
     {
         targetFSM = targetFSM ? targetFSM : this;
-        return _mapTransitionTable.insert_or_assign({from, onEvent}, TransitionTarget{to, targetFSM}).second;
+        const std::size_t fromIndex = this->lookup(from);
+        if (fromIndex == npos)
+            throw std::runtime_error("FSM('" + _name + "'): addTransition() did not find the requested source state '" + describe(from) + "'.");
+        const std::size_t toIndex = targetFSM->lookup(to);
+        if (toIndex == npos)
+            throw std::runtime_error("FSM('" + _name + "'): addTransition() did not find the requested target state '" + describe(to) + "'.");
+        return _mapTransitionTable.insert_or_assign({fromIndex, onEvent}, TransitionTarget{toIndex, targetFSM}).second;
     }
 
-    // The same as above but the states are identified by their names (i.e. strings)
-    bool addTransition(SV fromState, SV onEvent, SV toState, FSM* targetFSM = nullptr)
+    bool addTransition(StateHandle from, SV onEvent, StateHandle to, FSM* targetFSM = nullptr)
     {
-        targetFSM = targetFSM ? targetFSM : this;
-        StateHandle fromHandle = this->findHandle(fromState);
-        if (!fromHandle)
-            throw std::runtime_error("FSM('" + _name + "'): addTransition() did not find the requested source state '" + std::string(fromState) + "'.");
-        StateHandle toHandle = targetFSM->findHandle(toState);
-        if (!toHandle)
-            throw std::runtime_error("FSM('" + _name + "'): addTransition() did not find the requested target state'" + std::string(toState) + "'.");
+        return addTransition<StateHandle, StateHandle>(from, onEvent, to, targetFSM);
+    }
 
-        return addTransition(fromHandle, onEvent, toHandle, targetFSM);
+    bool addTransition(SV fromState, SV onEvent, SV toState, FSM* targetFSM = nullptr)
+    {
+        return addTransition<SV, SV>(fromState, onEvent, toState, targetFSM);
     }
 
     bool addTransition(StateHandle fromHandle, SV onEvent, SV toState, FSM* targetFSM = nullptr)
     {
-        targetFSM = targetFSM ? targetFSM : this;
-        StateHandle toHandle = targetFSM->findHandle(toState);
-        if (!toHandle)
-            throw std::runtime_error("FSM('" + _name + "'): addTransition() did not find the requested target state'" + std::string(toState) + "'.");
-        return addTransition(fromHandle, onEvent, toHandle, targetFSM);
+        return addTransition<StateHandle, SV>(fromHandle, onEvent, toState, targetFSM);
     }
 
     bool addTransition(SV fromState, SV onEvent, StateHandle toHandle, FSM* targetFSM = nullptr)
     {
-        targetFSM = targetFSM ? targetFSM : this;
-        StateHandle fromHandle = this->findHandle(fromState);
-        if (!fromHandle)
-            throw std::runtime_error("FSM('" + _name + "'): addTransition() did not find the requested source state '" + std::string(fromState) + "'.");
-        return addTransition(fromHandle, onEvent, toHandle, targetFSM);
+        return addTransition<SV, StateHandle>(fromState, onEvent, toHandle, targetFSM);
     }
 
     // A shortcut for writing "fsm << transition(from, event, to)" instead of "fsm.addTransition(from, event, to)"
@@ -510,16 +1095,21 @@ public:
 
     // Removes transition triggered by event 'onEvent' sent from 'fromState'.
     // Return true if the transition was found and successfully removed.
-    bool removeTransition(StateHandle fromState, SV onEvent)
+    template <StateType FROM>
+    bool removeTransition(const FROM& fromState, SV onEvent)
     {
-        auto erased = _mapTransitionTable.erase({fromState, onEvent});
+        auto erased = _mapTransitionTable.erase({lookup(fromState), onEvent});
         return bool(erased);
     }
 
+    bool removeTransition(StateHandle fromState, SV onEvent)
+    {
+        return removeTransition<StateHandle>(fromState, onEvent);
+    }
+
     bool removeTransition(SV fromState, SV onEvent)
     {
-        auto erased = _mapTransitionTable.erase({findHandle(fromState), onEvent});
-        return bool(erased);
+        return removeTransition<SV>(fromState, onEvent);
     }
 
     // A shortcut for writing "fsm >> transition(from, event)" instead of "fsm.removeTransition(from, event)"
@@ -531,14 +1121,20 @@ public:
     }
 
     // Return true if the FSM knows how to deal with event 'onEvent' sent from state 'fromState'.
+    template <StateType FROM>
+    bool hasTransition(const FROM& fromState, SV onEvent)
+    {
+        return _mapTransitionTable.contains({lookup(fromState), onEvent});
+    }
+
     bool hasTransition(StateHandle fromState, SV onEvent)
     {
-        return _mapTransitionTable.contains({fromState, onEvent});
+        return hasTransition<StateHandle>(fromState, onEvent);
     }
 
     bool hasTransition(SV fromState, SV onEvent)
     {
-        return _mapTransitionTable.contains({findHandle(fromState), onEvent});
+        return hasTransition<SV>(fromState, onEvent);
     }
 
     // Returns a vector of transition triplets {from-state, on-event, to-state}
@@ -547,27 +1143,76 @@ public:
         std::vector<std::array<SV, 3>> vecResult(_mapTransitionTable.size());
         for (std::size_t i = 0; const auto& [fromStateOnEvent, toState] : _mapTransitionTable) {
             auto& triple = vecResult[i++];
-            triple[0] = fromStateOnEvent.first.promise().name;
+            triple[0] = _vecStates[fromStateOnEvent.first].getName();
             triple[1] = fromStateOnEvent.second;
-            triple[2] = toState.state.promise().name;
+            triple[2] = toState.fsm->_vecStates[toState.state].getName();
         }
         return vecResult;
     }
 
     // Finds the target state of 'onEvent' when sent from 'fromState'.
     // Returns an empty string if not found.
-    const std::string& targetState(StateHandle fromState, SV onEvent)
+    template <StateType FROM>
+    const std::string& targetState(const FROM& fromState, SV onEvent)
     {
-       auto it = _mapTransitionTable.find({fromState, onEvent});
+       auto it = _mapTransitionTable.find({lookup(fromState), onEvent});
        if (it == _mapTransitionTable.end())
            return _sharedEmptyString;
         else
-            return it->second.state.promise().name;
+            return it->second.fsm->_vecStates[it->second.state].getName();
+    }
+
+    const std::string& targetState(StateHandle fromState, SV onEvent)
+    {
+        return targetState<StateHandle>(fromState, onEvent);
     }
 
     const std::string& targetState(SV fromState, SV onEvent)
     {
-        return targetState(findHandle(fromState), onEvent);
+        return targetState<SV>(fromState, onEvent);
+    }
+
+    // Result of the reachability analysis.
+    struct Reachability
+    {
+        std::size_t reachableStates = 0;
+        std::vector<std::string> unreachableStates;             // Names of the states no event can reach
+        std::vector<std::array<std::string, 2>> deadTransitions; // {from-state, event} of the transitions from them
+    };
+
+    // Finds the states which can not be reached from the given initial states (names) by
+    // following the transition table of this FSM, and the transitions which can never fire
+    // because they leave from such states. The error state set with setErrorState() counts
+    // as an initial state. States which are entered from other FSMs must be given as
+    // initial states because this FSM does not see the transitions of the others.
+    Reachability findUnreachable(const std::vector<SV>& initialStates) const
+    {
+        return report(reachable(initialStates));
+    }
+
+    // As above but also removes the unreachable states and their transitions from the FSM.
+    // The coroutine frames of the states are destroyed. The removed states leave empty slots
+    // behind so the indices of the other states do not change. Returns what was removed.
+    // Must not be called while the FSM is active or busy.
+    Reachability removeUnreachable(const std::vector<SV>& initialStates)
+    {
+        if (_bIsActive.load(std::memory_order_relaxed) || isBusyOrReplicaOut())
+            throw std::runtime_error("FSM('" + _name + "'): removeUnreachable() can not be called while the FSM is active or busy.");
+        const std::vector<bool> vecReached = reachable(initialStates);
+        Reachability result = report(vecReached);
+        std::erase_if(_mapTransitionTable, [&](const auto& entry) { return !vecReached[entry.first.first]; });
+        _mapTransitionTable.rehash(0); // Give back the buckets which are no longer needed.
+        for (std::size_t i = 0; i < _vecStates.size(); ++i) {
+            if (vecReached[i] || !_vecStates[i].isValid())
+                continue;
+            _memoryAccount->release(MemoryCategory::Names, _vecStates[i].chargedNameBytes());
+            std::unique_lock lock(_statesMutex);
+            State removed = std::move(_vecStates[i]); // Destroys the state at the end of the scope.
+            lock.unlock();
+            if (_state.load(std::memory_order_relaxed) == i)
+                _state.store(npos, std::memory_order_relaxed);
+        }
+        return result;
     }
 
     struct Awaitable
@@ -576,71 +1221,234 @@ public:
         constexpr bool await_ready() {return false;}
         std::coroutine_handle<> await_suspend(StateHandle fromState)
         {
-            const Event& onEvent = self->latestEvent();
-            // If a state emits an empty event all states will remain suspended.
-            // Consequently, the FSM will stopped. It can be restarted by calling sendEvent()
-            if (onEvent.isEmpty()) {
-                self->_bIsActive.store(false, std::memory_order_relaxed);
-                return std::noop_coroutine();
-            }
-
-            // Find the destination for {fromState, onEvent}-pair.
-            TransitionTarget to;
-            if (auto it = self->_mapTransitionTable.find({fromState, onEvent.name()}); it != self->_mapTransitionTable.end())
-                to = it->second;
-            else
-                throw std::runtime_error("FSM '" + self->name() + "' can't find transition from state '" +
-                                         std::string(fromState.promise().name) +
-                                         "' on event '" + std::string(onEvent.name()) + "'.\nPlease fix the transition table.");
-            // Typically the event is being sent to a state owned by this FSM (i.e. self).
-            // However, it may also be going to a state owned by another FSM.
-            // The destination FSM is in TransitionTarget struct together with the state handle.
-            if (to.fsm == self) {  // The target state lives in this FSM.
-                self->_state = to.state;
+            const std::size_t from = fromState.promise().index;
+            if (!self->isStateAt(from, fromState)) [[unlikely]]
+                throw std::runtime_error("FSM '" + self->name() + "': state '" + fromState.promise().name +
+                                         "' not found. A state must be added to the FSM before it emits events.");
+            return self->route(from);
+        }
 
-                if (self->logger)
-                    self->logger(self->name(), fromState.promise().name, onEvent, to.state.promise().name);
+        Event await_resume()
+        {
+            if (self->_event.isEmpty())
+                throw std::runtime_error("FSM '" + self->name() +  "': An empty event has been sent to state " + self->currentState());
+            return std::move(self->_event);
+        }
+    };
 
-                self->_bIsActive.store(true, std::memory_order_relaxed);
-                return to.state;
-            } else { // The target state lives in another FSM.
-                // Note: self FSM will suspend and self->state remains in the state where
-                //       it left off when to.fsm took over.
-                to.fsm->_state = to.state; // to.fsm will resume.
-                // Move the event to the target FSM. The event of the target FSM should be empty.
-                assert(to.fsm->_event.isEmpty());
-                to.fsm->_event = std::move(self->_event);
+    friend struct Awaitable;
 
+    // Awaitable for a state which does not recognize the event it received.
+    // The event is passed unchanged to the sink selected with setUnhandledPolicy()
+    // instead of being routed through the transition table.
+    struct UnhandledAwaitable
+    {
+        FSM* self;
+        constexpr bool await_ready() {return false;}
+        std::coroutine_handle<> await_suspend(StateHandle fromState)
+        {
+            if (self->_pScratch)
+                self->_pScratch->reset();
+            if (self->_bPauseRequested.load(std::memory_order_relaxed)) [[unlikely]]
+                self->park();
+            Event& onEvent = self->_event;
+            if (onEvent.isEmpty())
+                return self->idle();
+            ++self->_unhandledCount;
+
+            // An event which the error state itself rejects would come back to it forever,
+            // so it goes to the dead-letter queue instead.
+            const bool bFromErrorState = fromState.promise().index == self->_errorState;
+            if (self->_unhandledPolicy == Unhandled::ErrorState && !bFromErrorState) {
+                // The error state receives the event as it was sent to fromState.
+                self->_state.store(self->_errorState, std::memory_order_relaxed);
+                self->countTransition();
                 if (self->logger)
-                    self->logger(self->name()+"-->"+to.fsm->name(), fromState.promise().name, to.fsm->_event, to.state.promise().name);
-
-                // Self is suspended and to.fsm is resumed.
-                self->_bIsActive.store(false, std::memory_order_relaxed);
-                to.fsm->_bIsActive.store(true, std::memory_order_relaxed);
+                    self->logger(self->name(), fromState.promise().name, onEvent, self->currentState());
+                return self->enter(self->_errorState);
+            }
 
-                return to.state;
+            if (self->_unhandledPolicy != Unhandled::Count && self->_deadLetterCapacity > 0) {
+                if (self->_deadLetters.size() == self->_deadLetterCapacity)
+                    self->_deadLetters.pop_front(); // Make room by dropping the oldest one.
+                self->_deadLetters.push_back(std::move(onEvent));
+            } else {
+                onEvent.destroy();
             }
+            // fromState remains the current state so the next event will be sent to it.
+            return self->idle();
         }
 
         Event await_resume()
         {
-            if (self->_event.isEmpty())
-                throw std::runtime_error("FSM '" + self->name() +  "': An empty event has been sent to state " + self->currentState());
-            return std::move(self->_event);
+            return Awaitable{self}.await_resume();
         }
     };
 
-    friend struct Awaitable;
+    friend struct UnhandledAwaitable;
 
-    // Emits the given event and returns an awaitable which gives
-    // the next event sent to the awaiting state coroutine.
-    Awaitable emitAndReceive(Event* e)
+    // Tells the FSM that the given event was not recognized by the calling state
+    // and returns an awaitable which gives the next event sent to the state.
+    // Unlike throwing an exception, this is cheap enough to be used for every
+    // unknown event. For example "event = co_await fsm.rejectAndReceive(&event);"
+    UnhandledAwaitable rejectAndReceive(Event* e)
     {
         this->_event = std::move(*e);
-        return Awaitable{this};
+        return UnhandledAwaitable{this};
     }
 
-    struct InitialAwaitable
+    // What the FSM does with an event rejected with rejectAndReceive().
+    // In every case, the event is counted in unhandledCount().
+    enum class Unhandled {
+        Count,       // Discard the event and suspend the FSM (default).
+        DeadLetter,  // Move the event to the dead-letter queue and suspend the FSM.
+        ErrorState   // Send the event to the state given in setErrorState(). If the error state
+                     // rejects the event, too, it is moved to the dead-letter queue.
+    };
+
+    // Selects the sink for unhandled events.
+    FSM& setUnhandledPolicy(Unhandled policy)
+    {
+        if (policy == Unhandled::ErrorState && _errorState == npos)
+            throw std::runtime_error("FSM('" + _name + "'): setUnhandledPolicy() requires that the error state has been set with setErrorState().");
+        _unhandledPolicy = policy;
+        return *this;
+    }
+
+    // Routes unhandled events to the given state from now on.
+    FSM& setErrorState(SV stateName)
+    {
+        _errorState = lookup(stateName);
+        if (_errorState == npos)
+            throw std::runtime_error("FSM('" + _name + "'): setErrorState() did not find the requested state '" + std::string(stateName) + "'");
+        _unhandledPolicy = Unhandled::ErrorState;
+        return *this;
+    }
+
+    // Returns the number of events rejected with rejectAndReceive().
+    std::size_t unhandledCount() const { return _unhandledCount; }
+
+    // The dead-letter queue holds at most this many events. When it is full,
+    // the oldest event is discarded to make room for the new one.
+    FSM& setDeadLetterCapacity(std::size_t capacity)
+    {
+        _deadLetterCapacity = capacity;
+        while (_deadLetters.size() > _deadLetterCapacity)
+            _deadLetters.pop_front();
+        return *this;
+    }
+
+    // Returns the unhandled events collected under Unhandled::DeadLetter policy, the oldest first.
+    const std::deque<Event>& deadLetters() const { return _deadLetters; }
+
+    // Removes the events from the dead-letter queue and returns them to the caller.
+    std::deque<Event> takeDeadLetters() { return std::exchange(_deadLetters, {}); }
+
+    // Emits the given event and returns an awaitable which gives
+    // the next event sent to the awaiting state coroutine.
+    Awaitable emitAndReceive(Event* e)
+    {
+        this->_event = std::move(*e);
+        return Awaitable{this};
+    }
+
+    // Returns the awaiter of an awaitable like co_await does: the result of its member
+    // or free operator co_await, if it has one, or else the awaitable itself.
+    template <class A>
+    static decltype(auto) awaiterOf(A&& awaitable)
+    {
+        if constexpr (requires { std::forward<A>(awaitable).operator co_await(); })
+            return std::forward<A>(awaitable).operator co_await();
+        else if constexpr (requires { operator co_await(std::forward<A>(awaitable)); })
+            return operator co_await(std::forward<A>(awaitable));
+        else
+            return static_cast<A&>(awaitable);
+    }
+
+    // Awaitable which lets a state await an operation outside the FSM, e.g. a computation
+    // in a thread pool, in the middle of handling an event.
+    template <class A>
+    struct ExternalAwaitable
+    {
+        using Awaiter = decltype(awaiterOf(std::declval<A>()));
+
+        FSM* self;
+        A awaitable;
+        Awaiter awaiter;
+        std::size_t replicaOf = npos;  // Index of the replicated state if the awaiting state is a replica
+        std::size_t replica = 0;
+
+        ExternalAwaitable(FSM* fsm, A&& a)
+            : self(fsm), awaitable(std::forward<A>(a)), awaiter(awaiterOf(static_cast<A&&>(awaitable))) {}
+        // Not copyable nor movable because the awaiter may refer to the awaitable.
+        ExternalAwaitable(const ExternalAwaitable&) = delete;
+        ExternalAwaitable& operator=(const ExternalAwaitable&) = delete;
+        bool await_ready() { return awaiter.await_ready(); }
+        template <class Handle>
+        std::coroutine_handle<> await_suspend(Handle h)
+        {
+            FSM* fsm = self;
+            bool bReplica = false;
+            if constexpr (std::is_same_v<Handle, StateHandle>)
+                bReplica = fsm->beginReplicaExternal(h, replicaOf, replica);
+            if (!bReplica)
+                fsm->beginExternal();
+            // The operation may resume the state in another thread before
+            // the call returns, so this object must not be touched after it.
+            std::coroutine_handle<> next = std::noop_coroutine();
+            using Result = decltype(awaiter.await_suspend(h));
+            if constexpr (std::is_void_v<Result>)
+                awaiter.await_suspend(h);
+            else if constexpr (std::is_same_v<Result, bool>)
+                next = awaiter.await_suspend(h) ? next : std::coroutine_handle<>(h);
+            else
+                next = awaiter.await_suspend(h);
+            if (!bReplica)
+                return next;
+            if (next == h)  // Did not suspend after all. The replica rejoins in await_resume().
+                return h;
+            // The replica is out, so this thread goes on with the next events of the FSM.
+            if (next != std::noop_coroutine())
+                next.resume();
+            return fsm->resumeRunning();
+        }
+        decltype(auto) await_resume()
+        {
+            if (replicaOf != npos)
+                self->rejoin(replicaOf, replica);
+            return awaiter.await_resume();
+        }
+    };
+
+    // Returns an awaitable which awaits the given awaitable, which has await_ready(),
+    // await_suspend() and await_resume() or a member or free operator co_await
+    // which returns such an awaiter, in a state coroutine, e.g.
+    // "auto value = co_await fsm.awaitExternal(pool.compute(x));"
+    // From the suspension until the FSM has nothing more to do, the FSM is busy and
+    // sendEvent() buffers the events instead of resuming the state. The state continues
+    // in the thread which completes the operation and the buffered events are delivered
+    // in that thread in the order they were sent when the FSM would otherwise stop.
+    // If the state is a replica of a replicated state, the FSM is not held up: the thread
+    // goes on with the next events, which are routed to the other replicas, and the replica
+    // waits when it is resumed until no other thread runs the FSM.
+    template <class A>
+    ExternalAwaitable<A> awaitExternal(A&& awaitable)
+    {
+        return ExternalAwaitable<A>(this, std::forward<A>(awaitable));
+    }
+
+    // Returns true while a state awaits an external operation or the FSM handles
+    // the events which were buffered meanwhile.
+    bool isBusy() const { return _bBusy.load(std::memory_order_acquire); }
+
+    // Returns the number of events which wait for the FSM to stop being busy.
+    std::size_t numberOfBufferedEvents() const
+    {
+        std::lock_guard lock(_busyMutex);
+        return _buffered.size() + _backlog.size();
+    }
+
+    struct InitialAwaitable
     {
         FSM* self;
         constexpr bool await_ready() {return false;}
@@ -666,16 +1474,101 @@ public:
     // Returns the index of the vector to which the state was stored.
     std::size_t addState(State&& state)
     {
+        if (!state.isValid())
+            throw std::runtime_error("Attempt to add an invalid state to FSM " + _name);
         if (hasState(state.getName()))
             throw std::runtime_error("A state with name '" + state.getName() + "' already exists in FSM " + _name);
 
-        if (state.handle())
+        const std::size_t bytesOfName = nameBytes(state.getName());
+        if (!_memoryAccount->charge(MemoryCategory::Names, bytesOfName))
+            throw std::runtime_error("FSM('" + _name + "'): memory quota exceeded when adding state '" + state.getName() + "'.");
+        try {
+            chargeCallable(state);
+            state.chargedNameBytes() = bytesOfName;
+            std::lock_guard lock(_statesMutex);
+            state.setIndex(_vecStates.size());
             _vecStates.push_back(std::move(state));
-        else
-            throw std::runtime_error("Attempt to add an invalid state to FSM " + _name);
+        } catch (...) {
+            _memoryAccount->release(MemoryCategory::Names, bytesOfName);
+            throw;
+        }
         return _vecStates.size() - 1;
     }
 
+    // Adds a callable state which has no coroutine frame. Returns the index of the state.
+    // The FSM calls body(event) inline when it routes an event to the state. The body
+    // leaves the event to be emitted in the same object and the FSM routes it on
+    // right away. An empty event stops the FSM. For example
+    // "fsm.addState("Echo", [](Event& e) { e.construct<void>("EchoEvent"); });"
+    std::size_t addState(std::string stateName, State::Body body)
+    {
+        return addState(State(std::move(body), std::move(stateName)));
+    }
+
+    // Replaces the implementation of the named state with newState while the FSM is suspended
+    // and not busy. The new state takes the name and the index of the old one, so every transition
+    // from and to the state remains as it is and the table is not touched. If the old state had been
+    // started, the new one is started, too. The old coroutine is destroyed.
+    // Returns the index of the state. Finding the state by name takes time linear in the number
+    // of states, so replacing many states of a large FSM is faster by index.
+    std::size_t replaceState(SV stateName, State&& newState)
+    {
+        const std::size_t index = lookup(stateName);
+        if (index == npos)
+            throw std::runtime_error("FSM('" + _name + "'): state '" + std::string(stateName) + "' not found.");
+        return replaceState(index, std::move(newState));
+    }
+
+    // As above but the state is given by its index, as returned by addState() or replaceState().
+    // Takes constant time.
+    std::size_t replaceState(std::size_t index, State&& newState)
+    {
+        if (index >= _vecStates.size() || !_vecStates[index].isValid())
+            throw std::runtime_error("FSM('" + _name + "'): replaceState() was given index " + std::to_string(index) + " which is not a state.");
+        State& slot = _vecStates[index];
+        if (_bIsActive.load(std::memory_order_acquire) || isBusyOrReplicaOut())
+            throw std::runtime_error("FSM('" + _name + "'): can not replace state '" + slot.getName() + "' while the FSM is active or busy.");
+        if (!newState.isValid())
+            throw std::runtime_error("Attempt to replace state '" + slot.getName() + "' with an invalid state in FSM " + _name);
+
+        const bool bStart = slot.isStarted() && !newState.isStarted();
+        const std::size_t oldNameBytes = slot.chargedNameBytes();
+        newState.setName(slot.getName());
+        const std::size_t newNameBytes = nameBytes(newState.getName());
+        if (!_memoryAccount->charge(MemoryCategory::Names, newNameBytes))
+            throw std::runtime_error("FSM('" + _name + "'): memory quota exceeded when replacing state '" + slot.getName() + "'.");
+        try {
+            chargeCallable(newState);
+        } catch (...) {
+            _memoryAccount->release(MemoryCategory::Names, newNameBytes);
+            throw;
+        }
+        newState.chargedNameBytes() = newNameBytes;
+        _memoryAccount->release(MemoryCategory::Names, oldNameBytes);
+
+        // Move-assignment does not destroy the coroutine of the target, so the old state
+        // is moved out first and destroyed at the end of the scope.
+        std::unique_lock lock(_statesMutex);
+        State oldState = std::move(slot);
+        newState.setIndex(index);
+        slot = std::move(newState);
+        lock.unlock();
+        if (bStart)
+            startState(slot);
+        return index;
+    }
+
+    // As above but the new implementation is a callable state.
+    std::size_t replaceState(SV stateName, State::Body body)
+    {
+        return replaceState(stateName, State(std::move(body)));
+    }
+
+    std::size_t replaceState(std::size_t index, State::Body body)
+    {
+        return replaceState(index, State(std::move(body)));
+    }
+
     // Alias for the above.
     FSM& operator<<(State&& state)
     {
@@ -695,11 +1588,67 @@ public:
         for (auto& state : _vecStates) {
             // Resume only if the coroutine is still suspended in initial_suspend.
             if (!state.isStarted())
-                state.handle().resume();
+                startState(state);
         }
         return *this;
     }
 
+    // As above but the states are resumed in numThreads threads in parallel.
+    // This pays off if the state coroutines do a lot of work before the first
+    // co_await fsm.getEvent(). That work must not touch data shared with other states
+    // without synchronization. Returns after every state has been started.
+    FSM& start(unsigned numThreads)
+    {
+        parallelFor(_vecStates.size(), numThreads, [this](std::size_t i) {
+            if (!_vecStates[i].isStarted())
+                startState(_vecStates[i]);
+        });
+        return *this;
+    }
+
+    // Makes count states by calling makeState(i) for i = 0...count-1 in numThreads threads in parallel
+    // and adds the states to the FSM in the order of i. Returns the index of the first new state.
+    // Unlike adding the states one by one, checking the names for duplicates takes linear time.
+    template <class Factory>
+    requires std::is_invocable_r_v<State, Factory&, std::size_t>
+    std::size_t addStates(std::size_t count, Factory makeState, unsigned numThreads = 1)
+    {
+        std::vector<std::optional<State>> vecNew(count);
+        parallelFor(count, numThreads, [&](std::size_t i) { vecNew[i].emplace(makeState(i)); });
+
+        std::unordered_set<SV> names;
+        names.reserve(_vecStates.size() + count);
+        for (const State& state : _vecStates)
+            names.insert(state.getName());
+        std::size_t bytesOfNames = 0;
+        for (auto& state : vecNew) {
+            if (!state->isValid())
+                throw std::runtime_error("Attempt to add an invalid state to FSM " + _name);
+            if (!names.insert(state->getName()).second)
+                throw std::runtime_error("A state with name '" + state->getName() + "' already exists in FSM " + _name);
+            bytesOfNames += nameBytes(state->getName());
+            // If charging fails, the states charged so far are released when vecNew is destroyed.
+            chargeCallable(*state);
+        }
+
+        if (!_memoryAccount->charge(MemoryCategory::Names, bytesOfNames))
+            throw std::runtime_error("FSM('" + _name + "'): memory quota exceeded when adding " + std::to_string(count) + " states.");
+        const std::size_t firstIndex = _vecStates.size();
+        std::lock_guard lock(_statesMutex);
+        try {
+            _vecStates.reserve(firstIndex + count);
+        } catch (...) {
+            _memoryAccount->release(MemoryCategory::Names, bytesOfNames);
+            throw;
+        }
+        for (auto& state : vecNew) {
+            state->chargedNameBytes() = nameBytes(state->getName());
+            state->setIndex(_vecStates.size());
+            _vecStates.push_back(std::move(*state));
+        }
+        return firstIndex;
+    }
+
     // Kick off the state machine by sending the event.
     // It it sent to the state which
     // is either the state where the FSM left off when it was
@@ -707,12 +1656,28 @@ public:
     // set by calling setState().
     FSM& sendEvent(Event* pEvent)
     {
-        if (!_state.promise().bIsStarted)
+        // While a state awaits an external operation, the event waits in a buffer.
+        if (_bBusy.load(std::memory_order_acquire)) [[unlikely]] {
+            std::size_t state = npos;
+            if (buffer(pEvent, state))
+                return *this;
+            if (state != npos) // The oldest buffered event came from a cross-FSM transition.
+                _state.store(state, std::memory_order_relaxed);
+        }
+        const std::size_t state = _state.load(std::memory_order_relaxed);
+        if (state >= _vecStates.size())
+            throw std::runtime_error("FSM('" + _name + "'): sendEvent("+std::string(pEvent->name())+") has no state to send the event to. Call first fsm.setState().");
+        if (!_vecStates[state].isStarted())
             throw std::runtime_error("FSM('" + _name + "'): sendEvent("+std::string(pEvent->name())+") can not resume state "+
-                                     _state.promise().name+" because it has not been started. Call first fsm.start() to activate all states.");
+                                     currentState()+" because it has not been started. Call first fsm.start() to activate all states.");
+
+        if (_yieldFrom != npos)
+            throw std::runtime_error("FSM('" + _name + "'): sendEvent("+std::string(pEvent->name())+") while an event is pending in FairScheduler.");
 
         _event = std::move(*pEvent);
-        _state.resume();
+        countTransition();
+        activate();
+        enter(state).resume();
         return *this;
     }
 
@@ -720,32 +1685,96 @@ public:
     // Find the state based on the name. Throws if not found.
      const State& findState(SV name) const
      {
-        // Find the name from the list of states
-        for (const State& state : _vecStates)
-            if (state.getName() == name)
-                return state;
+        if (std::size_t i = lookup(name); i != npos)
+            return _vecStates[i];
         throw std::runtime_error("FSM('" + _name + "'): findState() did not find the requested name '" + std::string(name) + "'");
      }
 
     // Finds the state vector index where the state with the given name lives. Throws if not found.
      std::size_t findIndex(SV name) const
      {
-         for (std::size_t i = 0; i < _vecStates.size(); ++i)
-             if (_vecStates[i].getName() == name)
-                 return i;
+        if (std::size_t i = lookup(name); i != npos)
+            return i;
         throw std::runtime_error("FSM('" + _name + "'): findIndex() did not find the requested name '" + std::string(name) + "'");
      }
 
      // Returns true if the given state is registered in the fsm.
      bool hasState(SV name) const
      {
-        // Find the name from the list of states
-        for (const State& state : this->_vecStates)
-            if (state.getName() == name)
-                return true;
-         return false;
+        return lookup(name) != npos;
      }
 
+    // Adds an output port which carries values of type T out of the FSM.
+    // Returns reference to the port so that the consumer can drain it later.
+    template <class T>
+    OutputPort<T>& addOutputPort(std::string portName, std::size_t capacity = 1024)
+    {
+        auto pPort = std::make_shared<OutputPort<T>>(capacity);
+        auto [it, bInserted] = _mapOutputPorts.try_emplace(std::move(portName), pPort);
+        if (!bInserted)
+            throw std::runtime_error("FSM('" + _name + "'): output port '" + it->first + "' already exists.");
+        return *pPort;
+    }
+
+    // Returns reference to the output port. Throws if the port does not exist
+    // or if the type of its values is not T.
+    template <class T>
+    OutputPort<T>& outputPort(SV portName)
+    {
+        auto it = _mapOutputPorts.find(portName);
+        if (it == _mapOutputPorts.end())
+            throw std::runtime_error("FSM('" + _name + "'): output port '" + std::string(portName) + "' does not exist.");
+        auto ppPort = std::any_cast<std::shared_ptr<OutputPort<T>>>(&it->second);
+        if (!ppPort)
+            throw std::runtime_error("FSM('" + _name + "'): output port '" + std::string(portName) + "' does not carry values of the requested type.");
+        return **ppPort;
+    }
+
+    // Emits the value to the given output port without suspending the calling state.
+    // Returns false if the port is full and the value was dropped.
+    // The type of the values of the port must be given, e.g. "fsm.emitOut<double>("results", 3);",
+    // and the value is converted to it.
+    // A state which emits often should look up the port once with outputPort() and call its emitOut().
+    template <class T, class U>
+    requires std::constructible_from<T, U&&>
+    bool emitOut(SV portName, U&& value)
+    {
+        return outputPort<T>(portName).emitOut(std::forward<U>(value));
+    }
+
+    // Returns the scratch arena of the FSM, which is made at the first call.
+    // A state can use it for the temporary containers it needs while handling an event,
+    // for example "std::pmr::string text{&fsm.scratch()};". The arena is reset every time
+    // a state of this FSM emits an event, so the containers must be destroyed before that,
+    // i.e. they must not be alive over co_await.
+    ScratchArena& scratch()
+    {
+        if (!_pScratch)
+            _pScratch = std::make_unique<ScratchArena>();
+        return *_pScratch;
+    }
+
+    // Returns the account to which the memory of this FSM is charged.
+    // Events whose buffers should be charged to the FSM can be attached to it
+    // with event.setMemoryAccount(&fsm.memoryAccount()).
+    MemoryAccount& memoryAccount() const { return *_memoryAccount; }
+
+    // Returns the current memory usage of the account of this FSM.
+    MemoryUsage memoryUsage() const { return _memoryAccount->usage(); }
+
+    // Returns the number of events routed to the states of this FSM so far.
+    // The counter can be read from any thread, for example by a Watchdog.
+    std::uint64_t transitionCount() const { return _transitionCount.load(std::memory_order_relaxed); }
+
+    // Returns the name of the current state. Unlike currentState(), it can be called
+    // from any thread while the FSM is running, for example by a Watchdog.
+    std::string enteredState() const
+    {
+        const std::size_t index = _state.load(std::memory_order_relaxed);
+        std::lock_guard lock(_statesMutex);
+        return index < _vecStates.size() ? _vecStates[index].getName() : std::string{};
+    }
+
     // Returns true if the FSM is running and false if all states
     // are suspended and waiting for an event.
     const std::atomic<bool>& isActive() const { return _bIsActive; }
@@ -758,54 +1787,1825 @@ public:
 
 private:
     std::string _name;       // Name of the FSM (for information only)
-    Event _event;       // The latest event
-    StateHandle _state = nullptr; // Current state (for information only)
+    // Account to which the memory used by the FSM is charged. Must outlive the containers below.
+    // The frames of the state coroutines and the bodies of callable states share it.
+    friend struct State::promise_type;
+    std::shared_ptr<MemoryAccount> _memoryAccount = std::make_shared<MemoryAccount>();
+    static constexpr std::size_t npos = std::size_t(-1);
 
-    // Find the handle based on the name. Returns nullptr if not found.
-     StateHandle findHandle(SV name) const
+    Event _event;       // The latest event
+    std::unique_ptr<ScratchArena> _pScratch; // Made by scratch() when needed
+    // Index of the current state. Only the thread which runs the FSM writes it but
+    // enteredState() reads it from other threads, so it is accessed with relaxed loads and stores.
+    std::atomic<std::size_t> _state = npos;
+
+    // Find the index of the state based on the name, the handle or the state object.
+    // Returns npos if the state is not in this FSM.
+     std::size_t lookup(SV name) const
      {
         // Find the name from the list of states
-        for (const State& state : _vecStates)
-            if (state.getName() == name)
-                return state.handle();
-         return nullptr;
+        for (std::size_t i = 0; i < _vecStates.size(); ++i)
+            if (_vecStates[i].isValid() && _vecStates[i].getName() == name)
+                return i;
+         return npos;
+     }
+
+     std::size_t lookup(StateHandle handle) const
+     {
+         const std::size_t i = handle ? handle.promise().index : npos;
+         return (i < _vecStates.size() && _vecStates[i].handle() == handle) ? i : npos;
+     }
+
+     // A coroutine state which is not the object stored in the FSM (for example the one
+     // passed to addState() before it was moved) is found by its handle.
+     std::size_t lookup(const State& state) const
+     {
+         if (state.handle())
+             return lookup(state.handle());
+         const std::size_t i = state.isValid() ? state.index() : npos;
+         return (i < _vecStates.size() && &_vecStates[i] == &state) ? i : npos;
      }
 
-    // Hashes a coroutine handle
-    struct HandleHash
+    // Describes a state for an error message.
+    static std::string describe(SV name) { return std::string(name); }
+    static std::string describe(StateHandle handle) { return asHex(handle); }
+    static std::string describe(const State& state) { return state.getName(); }
+
+    // Gives the event in _event to the state at the given index and returns the coroutine
+    // which must be resumed next. A callable state is called right here and its event routed on.
+    std::coroutine_handle<> enter(std::size_t index)
+    {
+        const State& state = _vecStates[index];
+        if (state.handle())
+            return state.handle();
+        if (state.replicas_) [[unlikely]]
+            return enterReplica(index);
+        state.callable_->body(_event);
+        return route(index);
+    }
+
+    // True if the coroutine is the state at the index or one of its replicas.
+    bool isStateAt(std::size_t index, StateHandle h) const
+    {
+        if (index >= _vecStates.size())
+            return false;
+        const State& state = _vecStates[index];
+        if (state.handle() == h)
+            return true;
+        return state.replicas_ && std::any_of(state.replicas_->states.begin(), state.replicas_->states.end(),
+                                              [h](const State& replica) { return replica.handle() == h; });
+    }
+
+    // Resumes the coroutines of the state from initial_suspend.
+    static void startState(const State& state)
     {
-        std::size_t operator() (const StateHandle& h) const noexcept {
-            return std::hash<void*>()(h.address());
+        if (!state.replicas_) {
+            state.handle().resume();
+            return;
         }
-    };
+        for (const State& replica : state.replicas_->states)
+            if (!replica.isStarted())
+                replica.handle().resume();
+    }
+
+    // Returns the replica of the replicated state which handles the event, trying the
+    // replicas in turns. If every replica awaits an external operation, the event waits
+    // in the backlog until one of them is done.
+    std::coroutine_handle<> enterReplica(std::size_t index)
+    {
+        State::Replicas& replicas = *_vecStates[index].replicas_;
+        if (replicas.numOut < replicas.states.size()) {
+            while (replicas.bOut[replicas.next])
+                replicas.next = (replicas.next + 1) % replicas.states.size();
+            const std::size_t k = replicas.next;
+            replicas.next = (k + 1) % replicas.states.size();
+            return replicas.states[k].handle();
+        }
+        {
+            std::lock_guard lock(_busyMutex);
+            _backlog.emplace_back(index, std::move(_event));
+        }
+        return idle();
+    }
+
+    // True if a replica of the replicated state is free to handle an event.
+    bool hasFreeReplica(std::size_t index) const
+    {
+        const State::Replicas& replicas = *_vecStates[index].replicas_;
+        return replicas.numOut < replicas.states.size();
+    }
+
+    // The FSM has nothing more to do. Delivers the next event buffered while the FSM was busy,
+    // if any, or marks the FSM inactive. Returns the coroutine which must be resumed next.
+    std::coroutine_handle<> idle()
+    {
+        if (_bBusy.load(std::memory_order_relaxed)) [[unlikely]] {
+            std::unique_lock lock(_busyMutex);
+            // A replica which is done with its external operation goes first.
+            if (_numRejoining == 0) {
+                // The events which wait for a replica are older than the buffered ones.
+                if (!_backlog.empty() && hasFreeReplica(_backlog.front().first)) {
+                    const std::size_t state = _backlog.front().first;
+                    _state.store(state, std::memory_order_relaxed);
+                    _event = std::move(_backlog.front().second);
+                    _backlog.pop_front();
+                    lock.unlock();
+                    return enter(state);
+                }
+                while (!_buffered.empty()) {
+                    if (_buffered.front().first != npos)
+                        _state.store(_buffered.front().first, std::memory_order_relaxed);
+                    const std::size_t state = _state.load(std::memory_order_relaxed);
+                    _event = std::move(_buffered.front().second);
+                    _buffered.pop_front();
+                    if (state < _vecStates.size() && _vecStates[state].replicas_ && !hasFreeReplica(state)) {
+                        _backlog.emplace_back(state, std::move(_event));
+                        continue;
+                    }
+                    lock.unlock();
+                    countTransition();
+                    return enter(state);
+                }
+            }
+            // After this, another thread may call sendEvent() so the FSM must not be touched.
+            FSM* pStranded = std::exchange(_pStranded, nullptr);
+            markIdle();
+            _bRunning = false;
+            if (_buffered.empty() && _backlog.empty() && _numReplicasOut == 0)
+                _bBusy.store(false, std::memory_order_release);
+            if (_numRejoining > 0)
+                _cvRejoin.notify_one();
+            lock.unlock();
+            return pStranded ? deliverStranded(pStranded) : std::noop_coroutine();
+        }
+        if (_pStranded) [[unlikely]] {
+            FSM* pStranded = std::exchange(_pStranded, nullptr);
+            markIdle();
+            return deliverStranded(pStranded);
+        }
+        markIdle();
+        return std::noop_coroutine();
+    }
+
+    // Delivers the buffered events of the first FSM in the list of stranded FSMs which nobody
+    // else runs, and leaves the rest of the list to it. Returns the coroutine to be resumed next.
+    static std::coroutine_handle<> deliverStranded(FSM* pStranded)
+    {
+        while (pStranded) {
+            FSM& fsm = *pStranded;
+            std::unique_lock lock(fsm._busyMutex);
+            fsm._bStranded = false;
+            pStranded = std::exchange(fsm._pNextStranded, nullptr);
+            if (fsm._bRunning || fsm._numRejoining > 0 || (fsm._buffered.empty() && fsm._backlog.empty()))
+                continue;
+            fsm._bRunning = true;
+            lock.unlock();
+            fsm._pStranded = pStranded;
+            fsm.activate();
+            return fsm.idle();
+        }
+        return std::noop_coroutine();
+    }
+
+    // True while a state or a replica awaits an external operation or the events buffered
+    // meanwhile wait, so the states must not be replaced or removed even if the FSM is not active.
+    bool isBusyOrReplicaOut() const
+    {
+        std::lock_guard lock(_busyMutex);
+        return _bBusy.load(std::memory_order_relaxed) || _numReplicasOut > 0;
+    }
+
+    // Called when a state starts to await an external operation.
+    void beginExternal()
+    {
+        std::lock_guard lock(_busyMutex);
+        _bRunning = true;
+        _bBusy.store(true, std::memory_order_relaxed);
+    }
+
+    // Called when a busy FSM passes the event to another FSM and suspends. If events are still
+    // buffered, the FSM is put on the list of the target, whose thread delivers them when it
+    // stops. Without a target, they are delivered by the next sendEvent() before its own event.
+    void handOver(FSM* to)
+    {
+        std::lock_guard lock(_busyMutex);
+        _bRunning = false;
+        if (_buffered.empty() && _backlog.empty() && _numReplicasOut == 0)
+            _bBusy.store(false, std::memory_order_release);
+        if (_numRejoining > 0)
+            _cvRejoin.notify_one();
+        else if (to && !_bStranded && !(_buffered.empty() && _backlog.empty())) {
+            _bStranded = true;
+            _pNextStranded = std::exchange(to->_pStranded, this);
+        }
+    }
+
+    // Appends the list of stranded FSMs which the FSM passing the event to this one had.
+    void adoptStranded(FSM* pStranded)
+    {
+        FSM** ppLast = &_pStranded;
+        while (*ppLast)
+            ppLast = &(*ppLast)->_pNextStranded;
+        *ppLast = pStranded;
+    }
+
+    // Called when a replica of a replicated state starts to await an external operation.
+    // Marks the replica out so that the next events go to the other replicas. The thread
+    // gives the FSM up while it starts the operation, because the operation may resume
+    // the replica in the same thread and the replica must then be able to rejoin.
+    // Returns false if the state is not a replica.
+    bool beginReplicaExternal(StateHandle h, std::size_t& index, std::size_t& replica)
+    {
+        const std::size_t i = h.promise().index;
+        if (i >= _vecStates.size() || !_vecStates[i].replicas_)
+            return false;
+        index = i;
+        State::Replicas& replicas = *_vecStates[index].replicas_;
+        replica = 0;
+        while (replicas.states[replica].handle() != h)
+            ++replica;
+        replicas.bOut[replica] = true;
+        ++replicas.numOut;
+        std::lock_guard lock(_busyMutex);
+        ++_numReplicasOut;
+        _bRunning = false;
+        _bBusy.store(true, std::memory_order_relaxed);
+        if (_numRejoining > 0)
+            _cvRejoin.notify_one();
+        return true;
+    }
+
+    // Called by the thread of a replica which has started its external operation. Takes the
+    // FSM back to go on with the next events unless another thread runs the FSM, is about to
+    // run it or has already run it until it stopped. Returns the coroutine which must be resumed next.
+    std::coroutine_handle<> resumeRunning()
+    {
+        {
+            std::lock_guard lock(_busyMutex);
+            if (_bRunning || _numRejoining > 0 || !_bBusy.load(std::memory_order_relaxed))
+                return std::noop_coroutine();
+            _bRunning = true;
+        }
+        return idle();
+    }
+
+    // Marks the replica free again. Called by the thread which runs the FSM.
+    void endReplicaExternal(std::size_t index, std::size_t replica)
+    {
+        State::Replicas& replicas = *_vecStates[index].replicas_;
+        replicas.bOut[replica] = false;
+        --replicas.numOut;
+        std::lock_guard lock(_busyMutex);
+        --_numReplicasOut;
+    }
+
+    // Called by a replica which has been resumed after its external operation.
+    // Waits until no other thread runs the FSM and takes it over.
+    void rejoin(std::size_t index, std::size_t replica)
+    {
+        {
+            std::unique_lock lock(_busyMutex);
+            ++_numRejoining;
+            _cvRejoin.wait(lock, [this] { return !_bRunning; });
+            --_numRejoining;
+            _bRunning = true;
+        }
+        endReplicaExternal(index, replica);
+        activate();
+    }
+
+    // Buffers the event for the state at index 'state' (npos = the current state) if the FSM
+    // is busy and returns true. Returns false if the caller must run the FSM with the event
+    // in *pEvent, which is then the oldest buffered one, and 'state' is set to its state.
+    bool buffer(Event* pEvent, std::size_t& state)
+    {
+        std::lock_guard lock(_busyMutex);
+        if (!_bBusy.load(std::memory_order_relaxed))
+            return false;
+        _buffered.emplace_back(state, std::move(*pEvent));
+        // A replica which waits to rejoin will deliver the buffered events, too.
+        if (_bRunning || _numRejoining > 0)
+            return true;
+        // Nobody runs the FSM, so this thread takes over and delivers the buffered events in order.
+        _bRunning = true;
+        state = _buffered.front().first;
+        *pEvent = std::move(_buffered.front().second);
+        _buffered.pop_front();
+        return false;
+    }
+
+    // Marks the FSM active when a thread starts to run it.
+    void activate()
+    {
+        markActive();
+        parkIfRequested();
+    }
+
+    void markActive()
+    {
+        if (_pGroup) {
+            // Sequentially consistent so that either this thread sees the pause request
+            // or FSMGroup::pauseAll() sees that the FSM is active.
+            _bIsActive.store(true, std::memory_order_seq_cst);
+        } else {
+            _bIsActive.store(true, std::memory_order_relaxed);
+        }
+    }
+
+    // Marks the FSM idle when the thread stops running it.
+    void markIdle()
+    {
+        if (_pGroup) {
+            // Sequentially consistent like markActive() so that either this thread sees the
+            // pause request and wakes up FSMGroup::pauseAll() or pauseAll() sees that the FSM is idle.
+            _bIsActive.store(false, std::memory_order_seq_cst);
+            if (_bPauseRequested.load(std::memory_order_seq_cst))
+                notifyGroup();
+        } else {
+            _bIsActive.store(false, std::memory_order_release);
+        }
+    }
 
-    // Hash {state, event} - pair
+    // Must follow markActive() before a state of the FSM is resumed.
+    void parkIfRequested()
+    {
+        if (_pGroup && _bPauseRequested.load(std::memory_order_seq_cst))
+            park();
+    }
+
+    // Routes the event which was left pending when the quantum of FairScheduler ran out.
+    void continueRouting()
+    {
+        const std::size_t from = std::exchange(_yieldFrom, npos);
+        activate();
+        route(from).resume();
+    }
+
+    // Routes the event emitted by the state at index 'from' and returns the coroutine
+    // which must be resumed next. Callable states on the way are called inline
+    // until the event reaches a coroutine state or an empty event stops the FSM.
+    std::coroutine_handle<> route(std::size_t from)
+    {
+        FSM* self = this;
+        while (true) {
+            // The temporaries of the state which emitted the event are gone.
+            if (self->_pScratch)
+                self->_pScratch->reset();
+            // Safe point: the state has suspended and the event waits for routing.
+            if (self->_bPauseRequested.load(std::memory_order_relaxed)) [[unlikely]]
+                self->park();
+            const Event& onEvent = self->_event;
+            // If a state emits an empty event all states will remain suspended.
+            // Consequently, the FSM will stopped. It can be restarted by calling sendEvent()
+            if (onEvent.isEmpty())
+                return self->idle();
+            // Preemption point of FairScheduler: if the turn of the group has used up its
+            // quantum, the event is left pending and the scheduler routes it on the next turn.
+            if (Quantum* pQuantum = _pTurn) [[unlikely]] {
+                if (pQuantum->budget <= 0) {
+                    self->_yieldFrom = from;
+                    pQuantum->pYielded = self;
+                    self->markIdle();
+                    return std::noop_coroutine();
+                }
+                --pQuantum->budget;
+            }
+
+            // Find the destination for {fromState, onEvent}-pair.
+            TransitionTarget to;
+            if (auto it = self->_mapTransitionTable.find({from, onEvent.name()}); it != self->_mapTransitionTable.end())
+                to = it->second;
+            else
+                throw std::runtime_error("FSM '" + self->name() + "' can't find transition from state '" +
+                                         self->_vecStates[from].getName() +
+                                         "' on event '" + std::string(onEvent.name()) + "'.\nPlease fix the transition table.");
+            if (EventMeta* pMeta = self->_event.meta()) [[unlikely]] {
+                pMeta->sourceFsm = self;
+                pMeta->sourceState = from;
+            }
+            // A state of the target FSM awaits an external operation, so the event waits in
+            // the buffer of the target and self goes idle. If nobody runs the target, this
+            // thread takes it over with its oldest buffered event.
+            if (to.fsm != self && to.fsm->_bBusy.load(std::memory_order_acquire)) [[unlikely]] {
+                if (to.fsm->buffer(&self->_event, to.state))
+                    return self->idle();
+                if (to.state == npos)
+                    to.state = to.fsm->_state.load(std::memory_order_relaxed);
+            }
+            const State& target = to.fsm->_vecStates[to.state];
+            // Typically the event is being sent to a state owned by this FSM (i.e. self).
+            // However, it may also be going to a state owned by another FSM.
+            // The destination FSM is in TransitionTarget struct together with the state index.
+            if (to.fsm == self) {  // The target state lives in this FSM.
+                self->_state.store(to.state, std::memory_order_relaxed);
+
+                if (self->logger)
+                    self->logger(self->name(), self->_vecStates[from].getName(), onEvent, target.getName());
+
+                self->_bIsActive.store(true, std::memory_order_relaxed);
+                self->countTransition();
+            } else if (self->_pPlacement || to.fsm->_pPlacement) [[unlikely]] {
+                // The FSMs are run by the workers of AffinityRunner.
+                self = self->switchOwner(from, to.state, to.fsm);
+            } else { // The target state lives in another FSM.
+                // Note: self FSM will suspend and self->state remains in the state where
+                //       it left off when to.fsm took over.
+                to.fsm->_state.store(to.state, std::memory_order_relaxed); // to.fsm will resume.
+                // Move the event to the target FSM. The event of the target FSM should be empty.
+                assert(to.fsm->_event.isEmpty());
+                to.fsm->_event = std::move(self->_event);
+
+                if (self->logger)
+                    self->logger(self->name()+"-->"+to.fsm->name(), self->_vecStates[from].getName(), to.fsm->_event, target.getName());
+
+                // Self is suspended and to.fsm is resumed. To.fsm is marked active before self
+                // is marked idle so that FSMGroup::pauseAll() does not find both of them idle
+                // while the event passes between them.
+                to.fsm->markActive();
+                if (self->_pStranded) [[unlikely]]
+                    to.fsm->adoptStranded(std::exchange(self->_pStranded, nullptr));
+                self->markIdle();
+                if (self->_bBusy.load(std::memory_order_relaxed)) [[unlikely]]
+                    self->handOver(to.fsm);
+                to.fsm->countTransition();
+                self = to.fsm;
+                self->parkIfRequested();
+            }
+            // States may have been added to the target while it was parked, which moves them,
+            // so the target is looked up again.
+            const State& next = self->_vecStates[to.state];
+            if (next.handle())
+                return next.handle();
+            if (next.replicas_) [[unlikely]]
+                return self->enterReplica(to.state);
+            // A callable state handles the event inline and the event it emits is routed on.
+            next.callable_->body(self->_event);
+            from = to.state;
+        }
+    }
+
+    // Returns a flag for each state which tells if an event can reach the state
+    // from one of the initial states or the error state.
+    std::vector<bool> reachable(const std::vector<SV>& initialStates) const
+    {
+        const std::size_t n = _vecStates.size();
+        // The transitions within this FSM as adjacency lists in one vector.
+        std::vector<std::size_t> vecFirst(n + 1, 0), vecTargets;
+        for (const auto& [fromStateOnEvent, toState] : _mapTransitionTable)
+            if (toState.fsm == this)
+                ++vecFirst[fromStateOnEvent.first + 1];
+        for (std::size_t i = 0; i < n; ++i)
+            vecFirst[i + 1] += vecFirst[i];
+        vecTargets.resize(vecFirst[n]);
+        std::vector<std::size_t> vecNext(vecFirst.begin(), vecFirst.end() - 1);
+        for (const auto& [fromStateOnEvent, toState] : _mapTransitionTable)
+            if (toState.fsm == this)
+                vecTargets[vecNext[fromStateOnEvent.first]++] = toState.state;
+
+        std::vector<bool> vecReached(n, false);
+        std::vector<std::size_t> vecStack;
+        auto reach = [&](std::size_t i) {
+            if (!vecReached[i]) {
+                vecReached[i] = true;
+                vecStack.push_back(i);
+            }
+        };
+        for (SV state : initialStates) {
+            const std::size_t i = lookup(state);
+            if (i == npos)
+                throw std::runtime_error("FSM('" + _name + "'): did not find the initial state '" + describe(state) + "'.");
+            reach(i);
+        }
+        if (_errorState != npos)
+            reach(_errorState);
+        while (!vecStack.empty()) {
+            const std::size_t i = vecStack.back();
+            vecStack.pop_back();
+            for (std::size_t k = vecFirst[i]; k < vecFirst[i + 1]; ++k)
+                reach(vecTargets[k]);
+        }
+        return vecReached;
+    }
+
+    // Lists the states which were not reached and the transitions from them.
+    Reachability report(const std::vector<bool>& vecReached) const
+    {
+        Reachability result;
+        for (std::size_t i = 0; i < _vecStates.size(); ++i) {
+            if (vecReached[i])
+                ++result.reachableStates;
+            else if (_vecStates[i].isValid())
+                result.unreachableStates.push_back(_vecStates[i].getName());
+        }
+        for (const auto& [fromStateOnEvent, toState] : _mapTransitionTable)
+            if (!vecReached[fromStateOnEvent.first])
+                result.deadTransitions.push_back({_vecStates[fromStateOnEvent.first].getName(), std::string(fromStateOnEvent.second)});
+        return result;
+    }
+
+    // Charges the body of a callable state to the memory account of the FSM.
+    void chargeCallable(State& state)
+    {
+        if (!state.isCallable() || state.callable_->account)
+            return;
+        if (!_memoryAccount->charge(MemoryCategory::Frames, sizeof(State::Callable)))
+            throw std::runtime_error("FSM('" + _name + "'): memory quota exceeded when adding callable state '" + state.getName() + "'.");
+        state.callable_->account = _memoryAccount;
+    }
+
+    // Hash {state index, event} - pair
     struct PairHash
     {
-        std::size_t operator() (const std::pair<StateHandle, SV>& p) const noexcept {
+        std::size_t operator() (const std::pair<std::size_t, SV>& p) const noexcept {
             // Note: you could possibly do better than xor. See
             // https://stackoverflow.com/questions/5889238/why-is-xor-the-default-way-to-combine-hashes
-            return HandleHash{}(p.first) ^ std::hash<SV>()(p.second);
+            return std::hash<std::size_t>()(p.first) ^ std::hash<SV>()(p.second);
         }
     };
 
-    // Target state of a transition (i.e. go to the 'state' which belongs in 'fsm')
+    // Target state of a transition (i.e. go to the state at index 'state' which belongs in 'fsm')
     struct TransitionTarget
     {
-        StateHandle state = nullptr;
+        std::size_t state = npos;
         FSM* fsm = nullptr;
     };
 
+    // Output ports by name. Each value holds std::shared_ptr<OutputPort<T>>.
+    std::unordered_map<std::string, std::any, NameHash, std::equal_to<>> _mapOutputPorts;
+
     // Transition table in format {from-state, event} -> to-state
     // That is, an event sent from from-state will be routed to to-state.
-    std::unordered_map<std::pair<StateHandle,SV>, TransitionTarget, PairHash> _mapTransitionTable;
+    // The states are identified by their stable indices in the vector of states.
+    using TransitionKey = std::pair<std::size_t,SV>;
+    using TransitionAllocator = AccountingAllocator<std::pair<const TransitionKey, TransitionTarget>>;
+    std::unordered_map<TransitionKey, TransitionTarget, PairHash, std::equal_to<TransitionKey>, TransitionAllocator>
+        _mapTransitionTable{0, PairHash{}, std::equal_to<TransitionKey>{}, TransitionAllocator{_memoryAccount.get(), MemoryCategory::Table}};
 
     // All coroutines which represent the states in the state machine
-    std::vector<State> _vecStates;
+    std::vector<State, AccountingAllocator<State>> _vecStates{AccountingAllocator<State>{_memoryAccount.get(), MemoryCategory::States}};
+
+    // Calls f(i) for i = 0...n-1 in numThreads threads, each of which handles a contiguous range of i's.
+    // Rethrows the first exception thrown by f after all threads have finished.
+    template <class F>
+    static void parallelFor(std::size_t n, unsigned numThreads, F f)
+    {
+        numThreads = unsigned(std::clamp<std::size_t>(numThreads, 1, std::max<std::size_t>(n, 1)));
+        if (numThreads == 1) {
+            for (std::size_t i = 0; i < n; ++i)
+                f(i);
+            return;
+        }
+        std::exception_ptr pException;
+        std::mutex mutex;
+        {
+            std::vector<std::jthread> threads;
+            const std::size_t chunk = (n + numThreads - 1) / numThreads;
+            for (std::size_t begin = 0; begin < n; begin += chunk) {
+                threads.emplace_back([&, begin] {
+                    try {
+                        for (std::size_t i = begin; i < std::min(begin + chunk, n); ++i)
+                            f(i);
+                    } catch (...) {
+                        std::lock_guard lock(mutex);
+                        if (!pException)
+                            pException = std::current_exception();
+                    }
+                });
+            }
+        } // The threads are joined here.
+        if (pException)
+            std::rethrow_exception(pException);
+    }
+
+    // Returns the number of bytes the name of a state has allocated from the heap.
+    static std::size_t nameBytes(const std::string& name)
+    {
+        static const std::size_t sso = std::string().capacity();
+        return name.capacity() > sso ? name.capacity() + 1 : 0;
+    }
 
-    // True if the FSM is running, false if suspended.
+    // True if the FSM is running, false if suspended. Cleared with release order so that
+    // FSMGroup::pauseAll() sees the work done by the FSM before it stopped.
     std::atomic<bool> _bIsActive = false;
+
+    // Safe points. Set by FSMGroup::pauseAll(), the request makes the FSM park at the next
+    // transition boundary until FSMGroup::resumeAll() is called.
+    friend class FSMGroup;
+    FSMGroup* _pGroup = nullptr;
+    std::atomic<bool> _bPauseRequested = false;
+    bool _bParked = false;  // Guarded by the mutex of the group
+    void park();
+    void notifyGroup(); // Wakes up FSMGroup::pauseAll() when the FSM stops
+
+    // Set while a state awaits an external operation and until the events buffered
+    // meanwhile have been handled. The buffer and _bRunning are guarded by the mutex.
+    std::atomic<bool> _bBusy = false;
+    bool _bRunning = false;  // True if a thread runs the busy FSM
+    mutable std::mutex _busyMutex;
+    // Events with the index of the state they go to. npos means the current state,
+    // which is the case for the events given to sendEvent().
+    std::deque<std::pair<std::size_t, Event>> _buffered;
+    // Events routed to a replicated state whose replicas were all out, with the index of the state.
+    std::deque<std::pair<std::size_t, Event>> _backlog;
+    std::size_t _numReplicasOut = 0;  // Replicas awaiting an external operation
+    std::size_t _numRejoining = 0;    // Replicas waiting in rejoin()
+    std::condition_variable _cvRejoin;
+    // Busy FSMs which passed an event on to this FSM, directly or along a chain of transitions,
+    // with events left in their buffers. The thread which stops running this FSM delivers them.
+    // Touched only by the thread which runs this FSM.
+    FSM* _pStranded = nullptr;
+    FSM* _pNextStranded = nullptr;  // The next FSM in the list this FSM is in
+    bool _bStranded = false;        // True while the FSM is in a list, guarded by the mutex
+
+    // Budget of a turn given by FairScheduler to a group.
+    friend class FairScheduler;
+    struct Quantum
+    {
+        std::int64_t budget = 0;     // Transitions left in the turn
+        FSM* pYielded = nullptr;     // The FSM which stopped with a pending event when the budget ran out
+    };
+    Quantum* _pQuantum = nullptr;   // The quantum of the group of the FSM, if it is scheduled
+    std::size_t _yieldFrom = npos;  // The state which emitted the pending event
+    // The quantum of the turn which this thread is running. Every transition in the turn is
+    // charged to it, also after a cross-FSM transition to an FSM of another group or of none.
+    static inline thread_local Quantum* _pTurn = nullptr;
+
+    // Set if the FSM is run by AffinityRunner.
+    friend class AffinityRunner;
+    struct Placement;
+    Placement* _pPlacement = nullptr;
+    FSM* switchOwner(std::size_t from, std::size_t toState, FSM* to);
+
+    // Number of events routed to the states of this FSM. Only the thread which runs
+    // the FSM writes it so a relaxed load and store will do.
+    std::atomic<std::uint64_t> _transitionCount = 0;
+
+    void countTransition()
+    {
+        _transitionCount.store(_transitionCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    // Held while the vector of states or a name in it changes so that
+    // enteredState() can read a name from another thread.
+    mutable std::mutex _statesMutex;
+
+    // Sink for events rejected with rejectAndReceive()
+    Unhandled _unhandledPolicy = Unhandled::Count;
+    std::size_t _unhandledCount = 0;
+    std::size_t _errorState = npos;
+    std::size_t _deadLetterCapacity = 1024;
+    std::deque<Event> _deadLetters;
 }; // FSM
 
+// Watchdog thread which detects FSMs that have stopped making progress.
+// It periodically scans the transition counters of the watched FSMs. If an FSM
+// has been active in the same state longer than the deadline of the state,
+// the callback is called with the name of the FSM, the name of the state and
+// the time elapsed since the latest transition. The callback is called once per stall
+// from the watchdog thread. The FSMs pay nothing for being watched: the transition counter
+// and the current state are kept with relaxed stores which are done anyway.
+class Watchdog
+{
+public:
+    using Callback = std::function<void(const std::string& fsm, const std::string& state, std::chrono::milliseconds elapsed)>;
+
+    explicit Watchdog(Callback onStuck, std::chrono::milliseconds scanInterval = std::chrono::milliseconds{100})
+        : _onStuck(std::move(onStuck)), _scanInterval(scanInterval)
+    {
+        _thread = std::jthread([this](std::stop_token stopToken) { run(stopToken); });
+    }
+
+    Watchdog(const Watchdog&) = delete;
+    Watchdog& operator=(const Watchdog&) = delete;
+
+    // Starts watching the FSM. The deadline applies to every state which does not have a deadline of its own.
+    // The FSM must be unwatched or the watchdog destroyed before the FSM is destroyed.
+    void watch(const FSM& fsm, std::chrono::milliseconds deadline)
+    {
+        std::lock_guard lock(_mutex);
+        if (findEntry(fsm) == _entries.end())
+            _entries.push_back(Entry{&fsm, deadline, {}, fsm.transitionCount(), std::chrono::steady_clock::now(), false});
+        else
+            findEntry(fsm)->deadline = deadline;
+    }
+
+    // Sets the deadline of the named state of a watched FSM.
+    void setDeadline(const FSM& fsm, std::string_view stateName, std::chrono::milliseconds deadline)
+    {
+        std::lock_guard lock(_mutex);
+        auto it = findEntry(fsm);
+        if (it == _entries.end())
+            throw std::runtime_error("Watchdog: setDeadline() called for FSM '" + fsm.name() + "' which is not being watched.");
+        it->stateDeadlines.insert_or_assign(std::string(stateName), deadline);
+    }
+
+    // Stops watching the FSM.
+    void unwatch(const FSM& fsm)
+    {
+        std::lock_guard lock(_mutex);
+        if (auto it = findEntry(fsm); it != _entries.end())
+            _entries.erase(it);
+    }
+
+private:
+    struct Entry
+    {
+        const FSM* fsm;
+        std::chrono::milliseconds deadline;
+        std::unordered_map<std::string, std::chrono::milliseconds> stateDeadlines;
+        std::uint64_t lastCount;  // Transition count seen in the previous scan
+        std::chrono::steady_clock::time_point since; // When lastCount was first seen
+        bool bReported;  // The callback has been called for this stall
+    };
+
+    std::vector<Entry>::iterator findEntry(const FSM& fsm)
+    {
+        return std::find_if(_entries.begin(), _entries.end(), [&](const Entry& e) { return e.fsm == &fsm; });
+    }
+
+    void run(std::stop_token stopToken)
+    {
+        std::vector<std::tuple<std::string, std::string, std::chrono::milliseconds>> stuck;
+        std::unique_lock lock(_mutex);
+        while (true) {
+            _cvStop.wait_for(lock, stopToken, _scanInterval, [] { return false; });
+            if (stopToken.stop_requested())
+                return;
+            const auto now = std::chrono::steady_clock::now();
+            for (Entry& e : _entries) {
+                const std::uint64_t count = e.fsm->transitionCount();
+                if (count != e.lastCount || !e.fsm->isActive().load(std::memory_order_relaxed)) {
+                    e.lastCount = count;
+                    e.since = now;
+                    e.bReported = false;
+                    continue;
+                }
+                if (e.bReported)
+                    continue;
+                const std::string state = e.fsm->enteredState();
+                auto itDeadline = e.stateDeadlines.find(state);
+                auto deadline = (itDeadline != e.stateDeadlines.end()) ? itDeadline->second : e.deadline;
+                auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - e.since);
+                if (elapsed >= deadline) {
+                    e.bReported = true;
+                    stuck.emplace_back(e.fsm->name(), state, elapsed);
+                }
+            }
+            if (!stuck.empty()) { // Call back without holding the lock.
+                lock.unlock();
+                for (const auto& [fsmName, stateName, elapsed] : stuck)
+                    _onStuck(fsmName, stateName, elapsed);
+                stuck.clear();
+                lock.lock();
+            }
+        }
+    }
+
+    Callback _onStuck;
+    std::chrono::milliseconds _scanInterval;
+    std::mutex _mutex;
+    std::condition_variable_any _cvStop;
+    std::vector<Entry> _entries;
+    std::jthread _thread; // Must be the last member so that it is stopped first.
+}; // Watchdog
+
+// Thread-safe entry of events into an FSM or a group of FSMs, with admission control.
+// Producers in any thread submit() events, which are queued. The thread which runs the FSMs
+// calls deliver() to pass the queued events to sendEvent() of their target FSMs.
+// The admission is limited by a token bucket (rate and burst) and by the capacity of the queue.
+// In addition, the sojourn times of the events are watched like CoDel does: if the events
+// have waited longer than the target for a whole interval, the inbox sheds load until the
+// sojourn time falls below the target. What is done to an event under overload depends on
+// the policy of its class, i.e. the name of the event.
+class Inbox
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // What is done to the events of a class when the inbox is overloaded.
+    enum class Overload {
+        Drop,    // Discarded at submission if over the limits, and from the queue while shedding load (default).
+        Reject,  // Refused by submit() if over the limits or while shedding load. Admitted events are always delivered.
+        Exempt   // Always admitted and delivered.
+    };
+
+    // Result of submit()
+    enum class Admission { Accepted, Rejected, Dropped };
+
+    struct Limits
+    {
+        double rate = 0;      // Events per second admitted in the long run. 0 means no limit.
+        double burst = 1;     // Size of the token bucket, i.e. events admitted at once above the rate.
+        std::size_t capacity = std::size_t(-1);  // Maximum number of events waiting for delivery
+        std::chrono::nanoseconds target = std::chrono::milliseconds{5};     // Acceptable sojourn time
+        std::chrono::nanoseconds interval = std::chrono::milliseconds{100}; // Time above target before shedding starts
+    };
+
+    // Counters of one class of events or all of them.
+    struct Counters
+    {
+        std::uint64_t submitted = 0;
+        std::uint64_t delivered = 0;
+        std::uint64_t rejected = 0;  // Refused by submit()
+        std::uint64_t dropped = 0;   // Discarded by submit()
+        std::uint64_t shed = 0;      // Discarded from the queue
+    };
+
+    // If pTarget is not null, submit(Event*) sends the events to it.
+    explicit Inbox(FSM* pTarget = nullptr) : _pTarget(pTarget)
+    {
+        setLimits(Limits{});
+    }
+
+    Inbox(FSM* pTarget, const Limits& limits) : _pTarget(pTarget)
+    {
+        setLimits(limits);
+    }
+
+    Inbox(const Inbox&) = delete;
+    Inbox& operator=(const Inbox&) = delete;
+
+    void setLimits(const Limits& limits)
+    {
+        std::lock_guard lock(_mutex);
+        _limits = limits;
+        _tokens = limits.burst;
+        _lastRefill = Clock::now();
+    }
+
+    // Sets the policy of the events whose name is eventName.
+    void setPolicy(std::string_view eventName, Overload policy)
+    {
+        std::lock_guard lock(_mutex);
+        classOf(eventName).policy = policy;
+    }
+
+    // Sets the policy of the classes which have not been given one.
+    void setDefaultPolicy(Overload policy)
+    {
+        std::lock_guard lock(_mutex);
+        _defaultPolicy = policy;
+    }
+
+    // Queues the event for the target FSM given in the constructor.
+    Admission submit(Event* pEvent)
+    {
+        if (!_pTarget)
+            throw std::runtime_error("Inbox: submit() needs a target FSM because none was given in the constructor.");
+        return submit(*_pTarget, pEvent);
+    }
+
+    // Queues the event for the given FSM. If the event is accepted or dropped, *pEvent is left
+    // empty. If it is rejected, *pEvent is left untouched so the caller can retry later.
+    Admission submit(FSM& target, Event* pEvent)
+    {
+        const auto now = Clock::now();
+        {
+            std::lock_guard lock(_mutex);
+            Class& c = classOf(pEvent->name());
+            ++c.counters.submitted;
+            if (c.policy != Overload::Exempt) {
+                if (_limits.rate > 0) {
+                    _tokens = std::min(_limits.burst, _tokens + _limits.rate * std::chrono::duration<double>(now - _lastRefill).count());
+                    _lastRefill = now;
+                }
+                const bool bOverLimit = _queue.size() >= _limits.capacity || (_limits.rate > 0 && _tokens < 1) ||
+                                        (_bShedding && c.policy == Overload::Reject);
+                if (bOverLimit && c.policy == Overload::Reject) {
+                    ++c.counters.rejected;
+                    return Admission::Rejected;
+                }
+                if (bOverLimit) {
+                    ++c.counters.dropped;
+                    pEvent->destroy();
+                    return Admission::Dropped;
+                }
+                if (_limits.rate > 0)
+                    _tokens -= 1;
+            }
+            if (EventMeta* pMeta = pEvent->meta())
+                pMeta->enqueued = now;
+            _queue.push_back(Pending{&target, std::move(*pEvent), now, &c});
+        }
+        _cv.notify_one();
+        return Admission::Accepted;
+    }
+
+    // Sends at most maxEvents queued events to their FSMs in the order they were submitted
+    // and returns the number of events delivered. Must be called by the thread which runs the FSMs.
+    std::size_t deliver(std::size_t maxEvents = std::size_t(-1))
+    {
+        std::size_t n = 0;
+        for (Pending pending; n < maxEvents; ++n) {
+            {
+                std::lock_guard lock(_mutex);
+                if (!dequeue(pending))
+                    break;
+            }
+            // The lock is not held so that the states can submit new events.
+            pending.pTarget->sendEvent(&pending.event);
+        }
+        return n;
+    }
+
+    // Waits until there is something to deliver or the timeout expires.
+    // Returns true if there are events waiting.
+    bool wait(std::chrono::nanoseconds timeout)
+    {
+        std::unique_lock lock(_mutex);
+        return _cv.wait_for(lock, timeout, [this] { return !_queue.empty(); });
+    }
+
+    // Returns the number of events waiting for delivery.
+    std::size_t pending() const
+    {
+        std::lock_guard lock(_mutex);
+        return _queue.size();
+    }
+
+    // Returns true while the inbox is shedding load.
+    bool isShedding() const
+    {
+        std::lock_guard lock(_mutex);
+        return _bShedding;
+    }
+
+    // Returns the counters of the events whose name is eventName.
+    Counters counters(std::string_view eventName) const
+    {
+        std::lock_guard lock(_mutex);
+        auto it = _classes.find(eventName);
+        return it == _classes.end() ? Counters{} : it->second.counters;
+    }
+
+    // Returns the sums of the counters of all classes.
+    Counters totals() const
+    {
+        std::lock_guard lock(_mutex);
+        Counters sum;
+        for (const auto& [name, c] : _classes) {
+            sum.submitted += c.counters.submitted;
+            sum.delivered += c.counters.delivered;
+            sum.rejected += c.counters.rejected;
+            sum.dropped += c.counters.dropped;
+            sum.shed += c.counters.shed;
+        }
+        return sum;
+    }
+
+private:
+    struct Class
+    {
+        Overload policy;
+        Counters counters;
+    };
+
+    struct Pending
+    {
+        FSM* pTarget = nullptr;
+        Event event;
+        Clock::time_point since;  // When the event was queued
+        Class* pClass = nullptr;
+    };
+
+    Class& classOf(std::string_view eventName)
+    {
+        if (auto it = _classes.find(eventName); it != _classes.end())
+            return it->second;
+        return _classes.try_emplace(std::string(eventName), Class{_defaultPolicy, {}}).first->second;
+    }
+
+    // Takes the next event to be delivered. Sheds the events which may be dropped
+    // while the sojourn time stays above the target. Returns false if the queue is empty.
+    bool dequeue(Pending& next)
+    {
+        const auto now = Clock::now();
+        while (!_queue.empty()) {
+            Pending& head = _queue.front();
+            const bool bAbove = now - head.since > _limits.target;
+            if (!bAbove) {
+                _firstAbove = {};
+                _bShedding = false;
+            } else if (_firstAbove == Clock::time_point{}) {
+                _firstAbove = now + _limits.interval;
+            } else if (now >= _firstAbove && !_bShedding) {
+                // Start shedding. If the previous period was recent, continue at the rate where it ended.
+                _bShedding = true;
+                _dropCount = (_dropCount > 2 && now - _dropNext < 16 * _limits.interval) ? _dropCount - 2 : 0;
+                _dropNext = now;
+            }
+            if (_bShedding && bAbove && now >= _dropNext && head.pClass->policy == Overload::Drop) {
+                ++head.pClass->counters.shed;
+                _queue.pop_front();
+                // The interval between drops shrinks as the inverse square root of the drop count.
+                ++_dropCount;
+                _dropNext += std::chrono::duration_cast<Clock::duration>(_limits.interval / std::sqrt(double(_dropCount)));
+                continue;
+            }
+            ++head.pClass->counters.delivered;
+            next = std::move(head);
+            _queue.pop_front();
+            return true;
+        }
+        _firstAbove = {};
+        _bShedding = false;
+        return false;
+    }
+
+    FSM* _pTarget;
+    mutable std::mutex _mutex;
+    std::condition_variable _cv;
+    Limits _limits;
+    std::deque<Pending> _queue;
+    std::unordered_map<std::string, Class, NameHash, std::equal_to<>> _classes; // Owns the names, which the events do not outlive
+    Overload _defaultPolicy = Overload::Drop;
+    // Token bucket
+    double _tokens = 0;
+    Clock::time_point _lastRefill;
+    // Load shedding
+    bool _bShedding = false;
+    Clock::time_point _firstAbove;  // When the sojourn time will have been above target for an interval
+    Clock::time_point _dropNext;    // When the next event may be shed
+    std::uint32_t _dropCount = 0;
+}; // Inbox
+
+// A group of FSMs which can be paused together at transition boundaries, for example to
+// reconfigure the transition tables, to take a consistent checkpoint or to move the FSMs
+// to other threads. While no pause is requested, an FSM pays one relaxed load per transition
+// for being in a group.
+class FSMGroup
+{
+public:
+    FSMGroup() = default;
+    FSMGroup(const FSMGroup&) = delete;
+    FSMGroup& operator=(const FSMGroup&) = delete;
+    ~FSMGroup()
+    {
+        resumeAll();
+        for (FSM* fsm : _fsms)
+            fsm->_pGroup = nullptr;
+    }
+
+    // Adds the FSM to the group. An FSM can be in one group at a time.
+    // The FSM must be removed or the group destroyed before the FSM is destroyed.
+    void add(FSM& fsm)
+    {
+        std::lock_guard lock(_mutex);
+        if (fsm._pGroup)
+            throw std::runtime_error("FSMGroup: FSM '" + fsm.name() + "' is already in a group.");
+        if (_bPaused)
+            throw std::runtime_error("FSMGroup: can not add FSM '" + fsm.name() + "' while the group is paused.");
+        fsm._pGroup = this;
+        _fsms.push_back(&fsm);
+    }
+
+    void remove(FSM& fsm)
+    {
+        std::lock_guard lock(_mutex);
+        if (_bPaused)
+            throw std::runtime_error("FSMGroup: can not remove FSM '" + fsm.name() + "' while the group is paused.");
+        if (auto it = std::find(_fsms.begin(), _fsms.end(), &fsm); it != _fsms.end()) {
+            fsm._pGroup = nullptr;
+            _fsms.erase(it);
+        }
+    }
+
+    // Asks every FSM of the group to pause at the next transition boundary and waits until
+    // each one has either parked there with its pending event or is suspended waiting for
+    // an event. Until resumeAll(), sendEvent() to a member blocks and no state of a member
+    // runs, so the caller may modify the FSMs. Must not be called from a state of a member.
+    void pauseAll()
+    {
+        std::unique_lock lock(_mutex);
+        if (_bPaused)
+            return;
+        _bPaused = true;
+        for (FSM* fsm : _fsms)
+            fsm->_bPauseRequested.store(true, std::memory_order_seq_cst);
+        auto isQuiescent = [this] {
+            return std::all_of(_fsms.begin(), _fsms.end(), [](FSM* fsm) {
+                return fsm->_bParked || !fsm->_bIsActive.load(std::memory_order_seq_cst);
+            });
+        };
+        // The members notify when they park or stop.
+        _cv.wait(lock, isQuiescent);
+    }
+
+    // Lets the parked FSMs continue from where they stopped.
+    void resumeAll()
+    {
+        {
+            std::lock_guard lock(_mutex);
+            if (!_bPaused)
+                return;
+            _bPaused = false;
+            for (FSM* fsm : _fsms)
+                fsm->_bPauseRequested.store(false, std::memory_order_relaxed);
+        }
+        _cv.notify_all();
+    }
+
+    // Returns true between pauseAll() and resumeAll().
+    bool isPaused() const
+    {
+        std::lock_guard lock(_mutex);
+        return _bPaused;
+    }
+
+    // Returns the number of FSMs which are parked at a transition boundary.
+    std::size_t numberOfParked() const
+    {
+        std::lock_guard lock(_mutex);
+        return std::size_t(std::count_if(_fsms.begin(), _fsms.end(), [](const FSM* fsm) { return fsm->_bParked; }));
+    }
+
+    std::size_t size() const
+    {
+        std::lock_guard lock(_mutex);
+        return _fsms.size();
+    }
+
+private:
+    friend class FSM;
+
+    std::vector<FSM*> _fsms;
+    mutable std::mutex _mutex;
+    std::condition_variable _cv;
+    bool _bPaused = false;
+}; // FSMGroup
+
+// Runs the FSMs of several groups, e.g. tenants, on shared threads with weighted fair
+// queuing (deficit round-robin). Events are posted to the FSMs through the scheduler and
+// delivered by the threads which call run() or runSlice(). Each turn of a group may run
+// as many transitions as its deficit allows, which grows by quantum * weight per turn.
+// If the quantum runs out in the middle of a chain of transitions, the FSM stops at the
+// next transition boundary with the event pending and continues from there on the next
+// turn of the group, so a busy group can not starve the others.
+// The events of one group are handled by one thread at a time. The FSMs of a group must
+// get their events only through post(). The transitions are charged to the group whose turn
+// runs them, also after a cross-FSM transition to an FSM of another group, which then
+// continues on the turns of this group until the chain ends. As always, an FSM must not be
+// run by two threads at a time, so an FSM which other groups reach this way should not get
+// events of its own group meanwhile. The scheduler must be destroyed before the FSMs.
+class FairScheduler
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Stats
+    {
+        std::uint64_t transitions = 0;  // Transitions run on the turns of the group
+        std::uint64_t events = 0;       // Events delivered
+        std::uint64_t turns = 0;        // Turns given to the group
+        std::uint64_t preemptions = 0;  // Turns which ended because the quantum ran out
+        std::size_t pending = 0;        // Events waiting for delivery
+        Clock::duration totalQueueDelay{};  // Sum of the times from post() to delivery
+        Clock::duration maxQueueDelay{};
+    };
+
+    // The quantum is the number of transitions per turn of a group whose weight is 1.
+    explicit FairScheduler(std::uint64_t quantum = 100) : _quantum(std::max<std::uint64_t>(quantum, 1)) {}
+    FairScheduler(const FairScheduler&) = delete;
+    FairScheduler& operator=(const FairScheduler&) = delete;
+    // The events which have not been delivered are destroyed. So is the event of an FSM
+    // which was preempted while routing it, and the FSM is left idle in the state which emitted it.
+    ~FairScheduler()
+    {
+        for (const auto& [fsm, pGroup] : _members)
+            fsm->_pQuantum = nullptr;
+        // The preempted FSM may be in another group or in none if it was reached by a cross-FSM transition.
+        for (const auto& pGroup : _groups) {
+            if (FSM* fsm = pGroup->pYielded) {
+                fsm->_yieldFrom = FSM::npos;
+                fsm->_event.destroy();
+            }
+        }
+    }
+
+    // Adds a group and returns its id.
+    std::size_t addGroup(std::string name, unsigned weight = 1)
+    {
+        std::lock_guard lock(_mutex);
+        auto pGroup = std::make_unique<Group>();
+        pGroup->name = std::move(name);
+        pGroup->weight = std::max(weight, 1u);
+        _groups.push_back(std::move(pGroup));
+        return _groups.size() - 1;
+    }
+
+    // Adds the FSM to a group. The FSM must not be running and it must be in one scheduler at a time.
+    void add(std::size_t groupId, FSM& fsm)
+    {
+        std::lock_guard lock(_mutex);
+        Group& group = at(groupId);
+        if (fsm._pQuantum)
+            throw std::runtime_error("FairScheduler: FSM '" + fsm.name() + "' is already scheduled.");
+        fsm._pQuantum = &group.quantum;
+        _members.emplace(&fsm, &group);
+    }
+
+    // Changes the weight of a group. Takes effect from the next turn of the group.
+    void setWeight(std::size_t groupId, unsigned weight)
+    {
+        std::lock_guard lock(_mutex);
+        at(groupId).weight = std::max(weight, 1u);
+    }
+
+    unsigned weight(std::size_t groupId) const
+    {
+        std::lock_guard lock(_mutex);
+        return at(groupId).weight;
+    }
+
+    // Queues the event for the FSM, which must have been added to a group. The event is
+    // moved from. Can be called from any thread, including the states of the scheduled FSMs.
+    void post(FSM& fsm, Event* pEvent)
+    {
+        const Clock::time_point now = Clock::now();
+        {
+            std::lock_guard lock(_mutex);
+            auto it = _members.find(&fsm);
+            if (it == _members.end())
+                throw std::runtime_error("FairScheduler: FSM '" + fsm.name() + "' has not been added to a group.");
+            Group& group = *it->second;
+            if (EventMeta* pMeta = pEvent->meta())
+                pMeta->enqueued = now;
+            group.queue.push_back(Pending{&fsm, std::move(*pEvent), now});
+            if (group.bScheduled)
+                return;
+            group.bScheduled = true;
+            _runnable.push_back(&group);
+        }
+        _cv.notify_one();
+    }
+
+    // Gives one turn to the next group which has work. Returns the number of transitions
+    // run, which is 0 if no group had anything to do.
+    std::uint64_t runSlice()
+    {
+        std::unique_lock lock(_mutex);
+        if (_runnable.empty())
+            return 0;
+        Group& group = *_runnable.front();
+        _runnable.pop_front();
+        group.deficit += std::int64_t(_quantum * group.weight);
+        ++group.stats.turns;
+
+        std::uint64_t total = 0;
+        try {
+            while (group.deficit > 0) {
+                FSM* pFsm = std::exchange(group.pYielded, nullptr);
+                Pending next;
+                if (!pFsm) {
+                    if (group.queue.empty())
+                        break;
+                    next = std::move(group.queue.front());
+                    group.queue.pop_front();
+                    pFsm = next.fsm;
+                    const Clock::duration delay = Clock::now() - next.posted;
+                    group.stats.totalQueueDelay += delay;
+                    group.stats.maxQueueDelay = std::max(group.stats.maxQueueDelay, delay);
+                    ++group.stats.events;
+                }
+                // The transition into the first state of sendEvent() is charged, too.
+                const std::int64_t budget = next.fsm ? group.deficit - 1 : group.deficit;
+                group.quantum.budget = budget;
+                lock.unlock();
+                FSM::_pTurn = &group.quantum;
+                if (next.fsm)
+                    pFsm->sendEvent(&next.event);
+                else
+                    pFsm->continueRouting();
+                FSM::_pTurn = nullptr;
+                lock.lock();
+                group.pYielded = std::exchange(group.quantum.pYielded, nullptr);
+                const std::uint64_t used = std::uint64_t(budget - group.quantum.budget) + (next.fsm ? 1 : 0);
+                group.deficit -= std::int64_t(used);
+                group.stats.transitions += used;
+                total += used;
+            }
+        } catch (...) {
+            FSM::_pTurn = nullptr;
+            if (!lock.owns_lock())
+                lock.lock();
+            group.pYielded = std::exchange(group.quantum.pYielded, nullptr);
+            endTurn(group);
+            throw;
+        }
+        endTurn(group);
+        return total;
+    }
+
+    // Runs turns until stop is requested. Waits when there is nothing to do.
+    // Any number of threads may call this.
+    void run(std::stop_token stop)
+    {
+        while (!stop.stop_requested()) {
+            if (runSlice() == 0) {
+                std::unique_lock lock(_mutex);
+                _cv.wait(lock, stop, [this] { return !_runnable.empty(); });
+            }
+        }
+    }
+
+    Stats stats(std::size_t groupId) const
+    {
+        std::lock_guard lock(_mutex);
+        const Group& group = at(groupId);
+        Stats s = group.stats;
+        s.pending = group.queue.size() + (group.pYielded ? 1 : 0);
+        return s;
+    }
+
+    const std::string& groupName(std::size_t groupId) const
+    {
+        std::lock_guard lock(_mutex);
+        return at(groupId).name;
+    }
+
+    std::size_t numberOfGroups() const
+    {
+        std::lock_guard lock(_mutex);
+        return _groups.size();
+    }
+
+private:
+    struct Pending
+    {
+        FSM* fsm = nullptr;
+        Event event;
+        Clock::time_point posted;
+    };
+
+    struct Group
+    {
+        std::string name;
+        unsigned weight = 1;
+        std::int64_t deficit = 0;    // Transitions the group may still run
+        FSM::Quantum quantum;        // Budget of the turn, used by the FSMs of the group while running
+        FSM* pYielded = nullptr;     // The FSM which has an event pending from the previous turn
+        std::deque<Pending> queue;
+        Stats stats;
+        bool bScheduled = false;     // True if runnable or running
+    };
+
+    Group& at(std::size_t groupId) const
+    {
+        if (groupId >= _groups.size())
+            throw std::runtime_error("FairScheduler: no group " + std::to_string(groupId) + ".");
+        return *_groups[groupId];
+    }
+
+    // Puts the group back to the end of the round if it still has work.
+    // In deficit round-robin an idle group does not save its deficit.
+    void endTurn(Group& group)
+    {
+        if (group.pYielded)
+            ++group.stats.preemptions;
+        if (group.queue.empty() && !group.pYielded) {
+            group.deficit = 0;
+            group.bScheduled = false;
+        } else {
+            _runnable.push_back(&group);
+        }
+    }
+
+    std::uint64_t _quantum;
+    std::vector<std::unique_ptr<Group>> _groups;
+    std::unordered_map<FSM*, Group*> _members;
+    std::deque<Group*> _runnable;
+    mutable std::mutex _mutex;
+    std::condition_variable_any _cv;
+}; // FairScheduler
+
+// Bookkeeping of an FSM which is run by AffinityRunner.
+struct FSM::Placement
+{
+    struct Edge
+    {
+        std::atomic<const FSM*> to = nullptr;
+        std::atomic<std::uint64_t> count = 0;
+    };
+
+    std::atomic<bool> bOwned = false;       // True while a thread runs the FSM
+    std::atomic<std::size_t> worker = 0;    // The worker whose queue gets the events posted to the FSM
+    std::size_t inFlight = 0;               // Events posted but not handled yet, guarded by the mutex of the worker
+    std::uint64_t lastTransitions = 0;      // Transition count at the previous rebalance
+    std::array<Edge, 4> edges;              // Handoffs to the most frequent targets since the previous rebalance
+    const void* owner = nullptr;            // The runner
+
+    // The FSM owned by this thread, if any.
+    static inline thread_local FSM* pOwned = nullptr;
+
+    // Waits until no other thread runs the FSM and takes it.
+    void acquire()
+    {
+        while (bOwned.exchange(true, std::memory_order_acquire))
+            while (bOwned.load(std::memory_order_relaxed))
+                std::this_thread::yield();
+    }
+
+    // Counts a handoff to the given FSM. Only the thread which owns the FSM calls this.
+    void count(const FSM* to)
+    {
+        Edge* pLeast = &edges[0];
+        for (Edge& edge : edges) {
+            if (edge.to.load(std::memory_order_relaxed) == to) {
+                edge.count.store(edge.count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                return;
+            }
+            if (edge.count.load(std::memory_order_relaxed) < pLeast->count.load(std::memory_order_relaxed))
+                pLeast = &edge;
+        }
+        // Replace the least frequent target.
+        pLeast->to.store(to, std::memory_order_relaxed);
+        pLeast->count.store(1, std::memory_order_relaxed);
+    }
+};
+
+// Runs FSMs on a pool of worker threads and places the FSMs which pass events to each other
+// at high rates with cross-FSM transitions on the same worker, so that their frames and events
+// stay in the cache of one core. Loosely coupled FSMs are spread over the workers for parallelism.
+// Events are posted to the FSMs with post(). Each FSM belongs to one worker, which delivers the
+// events posted to it. A cross-FSM transition runs the target FSM in the same thread as before,
+// so the runner makes sure that no two threads run the same FSM at the same time.
+// Periodically, the handoff rates between pairs of FSMs are measured and the FSMs are placed
+// again: the pairs whose handoffs make up at least the given fraction of the transitions of
+// the less busy FSM are put in the same cluster as long as a cluster does not exceed its fair
+// share of the load by more than 25%, and the clusters are assigned to the workers, the
+// largest first, preferring the worker which already runs most of the cluster.
+// An FSM is moved to another worker only while it has no events posted or being handled.
+class AffinityRunner
+{
+public:
+    struct Coupling
+    {
+        std::string from, to;
+        double handoffsPerSecond;
+        bool bColocated;  // Whether the FSMs are on the same worker after the rebalance
+    };
+
+    struct Stats
+    {
+        std::uint64_t rebalances = 0;
+        std::uint64_t migrations = 0;           // FSMs moved to another worker
+        std::uint64_t deferredMigrations = 0;   // Moves skipped because the FSM had events in flight
+        std::vector<Coupling> couplings;        // Pairs with handoffs in the latest rebalance, strongest first
+        std::vector<std::pair<std::string, std::size_t>> placement;  // FSM name and worker
+        std::vector<std::uint64_t> eventsPerWorker;
+    };
+
+    // Starts the workers and, if the interval is not zero, a thread which rebalances periodically.
+    explicit AffinityRunner(unsigned numWorkers = std::thread::hardware_concurrency(),
+                            std::chrono::milliseconds interval = std::chrono::milliseconds{100}, double coupling = 0.1)
+        : _interval(interval), _coupling(coupling), _lastRebalance(std::chrono::steady_clock::now())
+    {
+        for (unsigned w = 0; w < std::max(numWorkers, 1u); ++w)
+            _workers.push_back(std::make_unique<Worker>());
+        for (auto& pWorker : _workers)
+            pWorker->thread = std::jthread([this, p = pWorker.get()](std::stop_token stopToken) { work(*p, stopToken); });
+        if (_interval.count() > 0)
+            _thread = std::jthread([this](std::stop_token stopToken) {
+                std::unique_lock lock(_mutex);
+                while (true) {
+                    _cvStop.wait_for(lock, stopToken, _interval, [] { return false; });
+                    if (stopToken.stop_requested())
+                        return;
+                    rebalanceLocked();
+                }
+            });
+    }
+
+    AffinityRunner(const AffinityRunner&) = delete;
+    AffinityRunner& operator=(const AffinityRunner&) = delete;
+
+    // Stops the threads. The events which have not been delivered are discarded.
+    ~AffinityRunner()
+    {
+        _thread = {};
+        for (auto& pWorker : _workers)
+            pWorker->thread.request_stop();
+        for (auto& pWorker : _workers)
+            pWorker->thread.join();
+        for (FSM* fsm : _fsms)
+            fsm->_pPlacement = nullptr;
+    }
+
+    // Adds an FSM. The FSMs are spread over the workers until the first rebalance.
+    // Must be called before any events are posted to the FSM. The FSM must not be destroyed
+    // before the runner and its events must be sent only with post().
+    void add(FSM& fsm)
+    {
+        std::lock_guard lock(_mutex);
+        if (fsm._pPlacement)
+            throw std::runtime_error("AffinityRunner: FSM '" + fsm.name() + "' has already been added to a runner.");
+        auto pPlacement = std::make_unique<FSM::Placement>();
+        pPlacement->worker = _fsms.size() % _workers.size();
+        pPlacement->lastTransitions = fsm.transitionCount();
+        pPlacement->owner = this;
+        fsm._pPlacement = pPlacement.get();
+        _placements.push_back(std::move(pPlacement));
+        _fsms.push_back(&fsm);
+    }
+
+    // Queues the event to the worker of the FSM. The event is moved from.
+    // Can be called from any thread, including the states of the FSMs.
+    void post(FSM& fsm, Event* pEvent)
+    {
+        FSM::Placement* pPlacement = fsm._pPlacement;
+        if (!pPlacement || pPlacement->owner != this)
+            throw std::runtime_error("AffinityRunner: FSM '" + fsm.name() + "' has not been added to this runner.");
+        _outstanding.fetch_add(1, std::memory_order_relaxed);
+        while (true) {
+            Worker& worker = *_workers[pPlacement->worker.load(std::memory_order_acquire)];
+            std::unique_lock lock(worker.mutex);
+            // The FSM may have moved to another worker in the meantime.
+            if (&worker != _workers[pPlacement->worker.load(std::memory_order_relaxed)].get())
+                continue;
+            worker.queue.push_back(Pending{&fsm, std::move(*pEvent)});
+            ++pPlacement->inFlight;
+            lock.unlock();
+            worker.cv.notify_one();
+            return;
+        }
+    }
+
+    // Waits until every posted event has been handled. If a state has thrown an exception
+    // in a worker meanwhile, the first one is rethrown.
+    void waitIdle() const
+    {
+        std::unique_lock lock(_mutex);
+        _cvIdle.wait(lock, [this] { return _outstanding.load(std::memory_order_acquire) == 0; });
+        if (std::exception_ptr pException = std::exchange(_pException, nullptr)) {
+            lock.unlock();
+            std::rethrow_exception(pException);
+        }
+    }
+
+    // Measures the handoff rates since the previous rebalance and places the FSMs again.
+    // Called periodically by the runner if the interval is not zero.
+    void rebalance()
+    {
+        std::lock_guard lock(_mutex);
+        rebalanceLocked();
+    }
+
+    // Returns the worker of the FSM.
+    std::size_t workerOf(const FSM& fsm) const
+    {
+        if (!fsm._pPlacement || fsm._pPlacement->owner != this)
+            throw std::runtime_error("AffinityRunner: FSM '" + fsm.name() + "' has not been added to this runner.");
+        return fsm._pPlacement->worker.load(std::memory_order_relaxed);
+    }
+
+    std::size_t numberOfWorkers() const { return _workers.size(); }
+
+    Stats stats() const
+    {
+        std::lock_guard lock(_mutex);
+        Stats stats = _stats;
+        for (std::size_t i = 0; i < _fsms.size(); ++i)
+            stats.placement.emplace_back(_fsms[i]->name(), _placements[i]->worker.load(std::memory_order_relaxed));
+        for (const auto& pWorker : _workers)
+            stats.eventsPerWorker.push_back(pWorker->delivered.load(std::memory_order_relaxed));
+        return stats;
+    }
+
+private:
+    struct Pending
+    {
+        FSM* fsm;
+        Event event;
+    };
+
+    struct Worker
+    {
+        std::mutex mutex;
+        std::condition_variable_any cv;
+        std::deque<Pending> queue;
+        std::atomic<std::uint64_t> delivered = 0;
+        std::jthread thread;
+    };
+
+    void work(Worker& worker, std::stop_token stopToken)
+    {
+        std::unique_lock lock(worker.mutex);
+        while (worker.cv.wait(lock, stopToken, [&] { return !worker.queue.empty(); })) {
+            Pending next = std::move(worker.queue.front());
+            worker.queue.pop_front();
+            lock.unlock();
+            FSM::Placement& placement = *next.fsm->_pPlacement;
+            placement.acquire();
+            FSM::Placement::pOwned = next.fsm;
+            try {
+                next.fsm->sendEvent(&next.event);
+            } catch (...) {
+                // The exception is rethrown by waitIdle(). The first one is kept.
+                std::lock_guard lockError(_mutex);
+                if (!_pException)
+                    _pException = std::current_exception();
+            }
+            // The events may have moved on to other FSMs with cross-FSM transitions.
+            if (FSM* pOwned = std::exchange(FSM::Placement::pOwned, nullptr))
+                pOwned->_pPlacement->bOwned.store(false, std::memory_order_release);
+            lock.lock();
+            --placement.inFlight;
+            worker.delivered.store(worker.delivered.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            if (_outstanding.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                // Under the mutex of the runner, so that waitIdle() cannot miss the notification.
+                // The worker's mutex is released first because rebalance() locks them the other way.
+                lock.unlock();
+                {
+                    std::lock_guard lockIdle(_mutex);
+                    _cvIdle.notify_all();
+                }
+                lock.lock();
+            }
+        }
+    }
+
+    // Measures the handoff rates and places the FSMs. Called with _mutex locked.
+    void rebalanceLocked()
+    {
+        const auto now = std::chrono::steady_clock::now();
+        const double seconds = std::max(std::chrono::duration<double>(now - _lastRebalance).count(), 1e-9);
+        _lastRebalance = now;
+        const std::size_t n = _fsms.size(), numWorkers = _workers.size();
+        if (n == 0)
+            return;
+
+        // The load of an FSM is the number of transitions it has run.
+        std::vector<std::uint64_t> load(n);
+        std::unordered_map<const FSM*, std::size_t> indexOf;
+        std::uint64_t totalLoad = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            const std::uint64_t count = _fsms[i]->transitionCount();
+            load[i] = std::max<std::uint64_t>(count - _placements[i]->lastTransitions, 1);
+            _placements[i]->lastTransitions = count;
+            totalLoad += load[i];
+            indexOf.emplace(_fsms[i], i);
+        }
+        std::unordered_map<std::uint64_t, std::uint64_t> pairCounts;  // Key = lower index * n + higher index
+        for (std::size_t i = 0; i < n; ++i)
+            for (FSM::Placement::Edge& edge : _placements[i]->edges) {
+                const std::uint64_t count = edge.count.exchange(0, std::memory_order_relaxed);
+                auto it = indexOf.find(edge.to.load(std::memory_order_relaxed));
+                if (count > 0 && it != indexOf.end() && it->second != i)
+                    pairCounts[std::min(i, it->second) * n + std::max(i, it->second)] += count;
+            }
+        std::vector<std::tuple<std::uint64_t, std::size_t, std::size_t>> pairs;  // {count, a, b}
+        for (const auto& [key, count] : pairCounts)
+            pairs.emplace_back(count, std::size_t(key / n), std::size_t(key % n));
+        std::sort(pairs.begin(), pairs.end(), std::greater<>());
+
+        // Cluster the strongly coupled FSMs with union-find, limiting the load of a cluster.
+        const std::uint64_t maxLoad = *std::max_element(load.begin(), load.end());
+        const double capacity = std::max(double(totalLoad) / double(numWorkers) * 1.25, double(maxLoad));
+        std::vector<std::size_t> parent(n);
+        std::vector<std::uint64_t> clusterLoad = load;
+        for (std::size_t i = 0; i < n; ++i)
+            parent[i] = i;
+        auto find = [&](std::size_t i) {
+            while (parent[i] != i)
+                i = parent[i] = parent[parent[i]];
+            return i;
+        };
+        for (const auto& [count, a, b] : pairs) {
+            const std::size_t ra = find(a), rb = find(b);
+            if (ra == rb || double(count) < _coupling * double(std::min(load[a], load[b])) ||
+                double(clusterLoad[ra] + clusterLoad[rb]) > capacity)
+                continue;
+            parent[rb] = ra;
+            clusterLoad[ra] += clusterLoad[rb];
+        }
+
+        // Assign the clusters to the workers, the largest first.
+        std::unordered_map<std::size_t, std::vector<std::size_t>> clusters;
+        for (std::size_t i = 0; i < n; ++i)
+            clusters[find(i)].push_back(i);
+        std::vector<std::size_t> roots;
+        for (const auto& [root, members] : clusters)
+            roots.push_back(root);
+        std::sort(roots.begin(), roots.end(), [&](std::size_t a, std::size_t b) { return clusterLoad[a] > clusterLoad[b]; });
+        std::vector<double> workerLoad(numWorkers, 0.0);
+        for (std::size_t root : roots) {
+            // The worker which runs most of the load of the cluster now.
+            std::vector<std::uint64_t> current(numWorkers, 0);
+            for (std::size_t i : clusters[root])
+                current[_placements[i]->worker.load(std::memory_order_relaxed)] += load[i];
+            std::size_t target = std::size_t(std::max_element(current.begin(), current.end()) - current.begin());
+            if (workerLoad[target] + double(clusterLoad[root]) > capacity)
+                target = std::size_t(std::min_element(workerLoad.begin(), workerLoad.end()) - workerLoad.begin());
+            workerLoad[target] += double(clusterLoad[root]);
+            for (std::size_t i : clusters[root])
+                migrate(*_placements[i], target);
+        }
+
+        ++_stats.rebalances;
+        _stats.couplings.clear();
+        for (const auto& [count, a, b] : pairs)
+            _stats.couplings.push_back(Coupling{_fsms[a]->name(), _fsms[b]->name(), double(count) / seconds,
+                                                _placements[a]->worker.load() == _placements[b]->worker.load()});
+    }
+
+    // Moves the FSM to the target worker if it has no events in flight.
+    void migrate(FSM::Placement& placement, std::size_t target)
+    {
+        const std::size_t source = placement.worker.load(std::memory_order_relaxed);
+        if (source == target)
+            return;
+        std::lock_guard lock(_workers[source]->mutex);
+        if (placement.inFlight > 0) {
+            ++_stats.deferredMigrations;
+            return;
+        }
+        placement.worker.store(target, std::memory_order_release);
+        ++_stats.migrations;
+    }
+
+    std::chrono::milliseconds _interval;
+    double _coupling;
+    std::vector<std::unique_ptr<Worker>> _workers;
+    std::vector<FSM*> _fsms;
+    std::vector<std::unique_ptr<FSM::Placement>> _placements;
+    std::atomic<std::uint64_t> _outstanding = 0;  // Events posted or being handled
+    std::chrono::steady_clock::time_point _lastRebalance;
+    Stats _stats;
+    mutable std::exception_ptr _pException;  // Thrown by a state in a worker, guarded by the mutex
+    mutable std::mutex _mutex;
+    mutable std::condition_variable _cvIdle;  // Notified when _outstanding drops to zero
+    std::condition_variable_any _cvStop;
+    std::jthread _thread;  // Rebalances periodically
+}; // AffinityRunner
+
+// Passes the event from this FSM to another one in a cross-FSM transition when either
+// of them is run by AffinityRunner. The ownership of the running thread moves from this
+// FSM to the target, which may have to wait until another thread has stopped running it.
+// The event is taken out of this FSM first, so two threads which pass events to each
+// other's FSMs do not deadlock. Returns the target.
+inline FSM* FSM::switchOwner(std::size_t from, std::size_t toState, FSM* to)
+{
+    if (logger)
+        logger(name() + "-->" + to->name(), _vecStates[from].getName(), _event, to->_vecStates[toState].getName());
+    Event event = std::move(_event);
+    markIdle();
+    // The events buffered meanwhile wait for the next sendEvent() because only the worker
+    // which owns the FSM may deliver them.
+    if (_bBusy.load(std::memory_order_relaxed))
+        handOver(nullptr);
+    if (_pPlacement) {
+        _pPlacement->count(to);
+        Placement::pOwned = nullptr;
+        _pPlacement->bOwned.store(false, std::memory_order_release);
+    }
+    // This FSM must not be touched after this.
+    if (to->_pPlacement) {
+        to->_pPlacement->acquire();
+        Placement::pOwned = to;
+    }
+    to->_state.store(toState, std::memory_order_relaxed);
+    assert(to->_event.isEmpty());
+    to->_event = std::move(event);
+    to->markActive();
+    to->countTransition();
+    // Both FSMs may have looked idle to FSMGroup::pauseAll() while the event was in transit,
+    // so the target parks here with the event if a pause has been requested meanwhile.
+    to->parkIfRequested();
+    return to;
+}
+
+// Called by the thread which runs the FSM when a pause has been requested.
+inline void FSM::notifyGroup()
+{
+    std::lock_guard lock(_pGroup->_mutex);
+    _pGroup->_cv.notify_all();
+}
+
+inline void FSM::park()
+{
+    FSMGroup* pGroup = _pGroup;
+    if (!pGroup)
+        return;
+    std::unique_lock lock(pGroup->_mutex);
+    _bParked = true;
+    pGroup->_cv.notify_all();
+    pGroup->_cv.wait(lock, [this] { return !_bPauseRequested.load(std::memory_order_relaxed); });
+    _bParked = false;
+}
+
+template <class... Args>
+inline void* State::promise_type::operator new(std::size_t size, FSM& fsm, const Args&...)
+{
+    const std::shared_ptr<MemoryAccount>& account = fsm._memoryAccount;
+    if (!account->charge(MemoryCategory::Frames, size + headerSize))
+        throw std::runtime_error("FSM('" + fsm.name() + "'): memory quota exceeded when creating a state coroutine.");
+    try {
+        return allocateFrame(size, account);
+    } catch (...) {
+        account->release(MemoryCategory::Frames, size + headerSize);
+        throw;
+    }
+}
+
 } // namespace CoFSM
 #endif // COFSM_H